@@ -157,6 +157,8 @@ static inline uint32_t REGM(enum z1xx_reg reg, uint8_t count)
 
 /*
  * Bits for G2D_CONFIG:
+ * (ARGBMASK bits are the channels *not* written, 0x8 for alpha down to
+ * 0x1 for blue, and need DST to read back the rest)
  */
 #define G2D_CONFIG_DST                 (1 << 0)
 #define G2D_CONFIG_SRC1                (1 << 1)
@@ -176,6 +178,19 @@ static inline uint32_t REGM(enum z1xx_reg reg, uint8_t count)
 #define G2D_CONFIG_NOPROTECT           (1 << 19)
 
 
+/*
+ * Bits for G2D_ROP:
+ * (inferred rather than documented: a ROP3 code, with the src or fill
+ * color as S and the dst as D, in both bytes.  It only applies when the
+ * blender is bypassed, and ROPs which read D need G2D_CONFIG_DST.
+ * Neither the 0x0000 in the canned state nor the 0x0404 written with the
+ * context acts as a ROP3, plain copies and fills work with both.  So it
+ * is only replaced for other ROPs, and a ROP3 of 0 can't be used.  Not
+ * yet confirmed on hw, so only used with Option "RasterOps")
+ */
+#define G2D_ROP_ROP3(val)              (((val) & 0xff) | (((val) & 0xff) << 8))
+
+
 /*
  * Bits for G2D_INPUT:
  */
@@ -157,25 +157,164 @@ ring_post(struct fd_ringbuffer *ring)
 	OUT_RING(ring, REG(VGV3_LAST) | 0x0);
 }
 
+/* is the specified timestamp known to have retired?  The kernel can't
+ * be asked about a timestamp without blocking (kgsl ignores the timeout
+ * of fd_pipe_wait_timeout() and does a fixed length wait), so this only
+ * knows about what an earlier msm_pipe_wait() or busy_retired() saw
+ * retire:
+ */
+static Bool
+timestamp_retired(MSMPtr pMsm, uint32_t timestamp)
+{
+	/* nothing is going to retire on a hung gpu, so consider it all
+	 * done with until it is recovered:
+	 */
+	if (pMsm->ring.hung || pMsm->ring.lost)
+		return TRUE;
+	return (int32_t)(pMsm->ring.retired - timestamp) >= 0;
+}
+
+static void
+note_retired(MSMPtr pMsm, uint32_t timestamp)
+{
+	if ((int32_t)(timestamp - pMsm->ring.retired) > 0)
+		pMsm->ring.retired = timestamp;
+}
+
+#ifdef HAVE_FD_PIPE_WAIT_TIMEOUT
+/* kgsl hands back the ioctl's -1 and errno, msm a -errno: */
+static int
+wait_error(int ret)
+{
+	return (ret == -1) ? -errno : ret;
+}
+#endif
+
 void
-next_ring(MSMPtr pMsm)
+msm_pipe_wait(MSMPtr pMsm, uint32_t timestamp, enum msm_wait_site site)
 {
-	struct fd_ringbuffer *ring;
-	int idx = pMsm->ring.idx++ % ARRAY_SIZE(pMsm->ring.rings);
+	uint64_t start;
+
+	if (pMsm->ring.hung || pMsm->ring.lost)
+		return;
+
+	start = msm_time_us();
+#ifdef HAVE_FD_PIPE_WAIT_TIMEOUT
+	if (pMsm->ring.hang_timeout) {
+		uint64_t timeout = (uint64_t)pMsm->ring.hang_timeout * 1000;
+		uint64_t elapsed = 0;
+		int err;
+
+		/* only running out of time is a hang.  Being interrupted
+		 * just means waiting again, and so does an early timeout
+		 * from kgsl, which ignores ours and waits for its own fixed
+		 * time instead.  A hang is still only seen once the kernel's
+		 * own wait has run out, if that is longer:
+		 */
+		do {
+			err = wait_error(fd_pipe_wait_timeout(pMsm->pipe,
+					timestamp, (elapsed < timeout) ?
+					(timeout - elapsed) * 1000 : 0));
+			elapsed = msm_time_us() - start;
+		} while ((err == -EINTR) ||
+				((err == -ETIMEDOUT) && (elapsed < timeout)));
+
+		msm_stats_wait(pMsm, site, start);
 
-	if (pMsm->ring.rings[idx]) {
-		ring = pMsm->ring.ring = pMsm->ring.rings[idx];
-		fd_ringbuffer_reset(ring);
+		if (err == -ETIMEDOUT) {
+			pMsm->ring.hung = TRUE;
+			pMsm->ring.hang_timestamp = timestamp;
+			pMsm->ring.hang_start = start;
+			pMsm->ring.hangs++;
+		} else if (!err) {
+			/* any other error leaves it not known to be done: */
+			note_retired(pMsm, timestamp);
+		}
 		return;
 	}
+#endif
+	fd_pipe_wait(pMsm->pipe, timestamp);
+	msm_stats_wait(pMsm, site, start);
+	note_retired(pMsm, timestamp);
+}
+
+/* wait for the submit with the given serial (0 for none) to complete,
+ * submitting it first if it is still being built:
+ */
+void
+msm_serial_wait(MSMPtr pMsm, uint32_t serial, enum msm_wait_site site)
+{
+	uint32_t timestamp;
 
-	ring = pMsm->ring.ring = pMsm->ring.rings[idx] =
-			fd_ringbuffer_new(pMsm->pipe,
-					0x4000 + STATE_SIZE * sizeof(uint32_t));
+	if (!serial)
+		return;
 
-	/* for now, until state packet is understood, just use a pre-canned
-	 * state captured from libC2D2 test, and fix up the gpu addresses
+	if (serial == pMsm->ring.serial)
+		FIRE_RING(pMsm, FLUSH_SYNC);
+
+	/* too old to be remembered, so wait for the oldest submit which
+	 * is, it can only complete after this one:
 	 */
+	if ((pMsm->ring.serial - serial) > MSM_SERIALS)
+		serial = pMsm->ring.serial - MSM_SERIALS;
+
+	/* timestamp_retired() doesn't block, so any stall happens in
+	 * msm_pipe_wait(), with hang detection, and shows up in the stats:
+	 */
+	timestamp = pMsm->ring.serial_timestamps[serial % MSM_SERIALS];
+	if (!timestamp_retired(pMsm, timestamp))
+		msm_pipe_wait(pMsm, timestamp, site);
+}
+
+/* number of consecutive flushes of a (nearly) full ringbuffer before we
+ * grow the ringbuffer size, and time without any rendering before we
+ * shrink the pool back down:
+ */
+#define RING_GROW_FLUSHES   4
+#define RING_IDLE_TIME      5000   /* ms */
+
+static uint32_t
+ring_size(MSMPtr pMsm)
+{
+	return pMsm->ring.size + STATE_SIZE * sizeof(uint32_t);
+}
+
+static struct fd_ringbuffer *
+new_ring(MSMPtr pMsm)
+{
+	struct fd_ringbuffer *ring;
+
+	ring = fd_ringbuffer_new(pMsm->pipe, ring_size(pMsm));
+	if (!ring)
+		return NULL;
+
+	pMsm->ring.nrings++;
+
+	/* the state is already patched up, and is left untouched by
+	 * fd_ringbuffer_reset() so recycled ringbuffers keep it:
+	 */
+	memcpy(ring->start, pMsm->ring.state->start,
+			STATE_SIZE * sizeof(uint32_t));
+
+	return ring;
+}
+
+/* for now, until state packet is understood, just use a pre-canned
+ * state captured from libC2D2 test, and fix up the gpu addresses.  This
+ * is done once, into a ringbuffer which is never submitted itself but
+ * just serves as the template for new_ring().  The relocs are resolved
+ * to gpu addresses at emit time, and the context bo's live as long as
+ * the screen, so the patched dwords stay valid when copied.
+ */
+static struct fd_ringbuffer *
+new_state(MSMPtr pMsm)
+{
+	struct fd_ringbuffer *ring;
+
+	ring = fd_ringbuffer_new(pMsm->pipe, STATE_SIZE * sizeof(uint32_t));
+	if (!ring)
+		return NULL;
+
 	memcpy(ring->start, initial_state, STATE_SIZE * sizeof(uint32_t));
 	ring->cur = &ring->start[120];
 	OUT_RELOC(ring, pMsm->ring.context_bos[0], TRUE);
@@ -184,7 +323,353 @@ next_ring(MSMPtr pMsm)
 	ring->cur = &ring->start[124];
 	OUT_RELOC(ring, pMsm->ring.context_bos[2], TRUE);
 
+	return ring;
+}
+
+static void
+del_ring(MSMPtr pMsm, struct fd_ringbuffer *ring)
+{
+	fd_ringbuffer_del(ring);
+	pMsm->ring.nrings--;
+}
+
+/* take the oldest ringbuffer off the busy list: */
+static struct fd_ringbuffer *
+pop_busy(MSMPtr pMsm)
+{
+	int head = pMsm->ring.busy_head;
+
+	if (pMsm->ring.busy[head].probe)
+		fd_bo_del(pMsm->ring.busy[head].probe);
+	pMsm->ring.busy_head = (head + 1) % MSM_MAX_RINGS;
+	pMsm->ring.nbusy--;
+
+	return pMsm->ring.busy[head].ring;
+}
+
+/* point the gpu at the context bos: */
+static void
+out_context(MSMPtr pMsm)
+{
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+
+	BEGIN_RING(pMsm, 8);
+	OUT_RING  (ring, REGM(VGV1_DIRTYBASE, 3));
+	OUT_RELOC (ring, pMsm->ring.context_bos[0], TRUE); /* VGV1_DIRTYBASE */
+	OUT_RELOC (ring, pMsm->ring.context_bos[1], TRUE); /* VGV1_CBASE1 */
+	OUT_RELOC (ring, pMsm->ring.context_bos[2], TRUE); /* VGV1_UBASE2 */
+	OUT_RING  (ring, 0x11000000);
+	OUT_RING  (ring, 0x10fff000);
+	OUT_RING  (ring, 0x10ffffff);
+	OUT_RING  (ring, 0x0d000404);
+}
+
+/* set up the context and the first ringbuffer, which starts with the
+ * context setup packet:
+ */
+static Bool
+setup_2d(MSMPtr pMsm)
+{
+	pMsm->ring.context_bos[0] = fd_bo_new(pMsm->dev, 0x1000,
+			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	pMsm->ring.context_bos[1] = fd_bo_new(pMsm->dev, 0x9000,
+			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	pMsm->ring.context_bos[2] = fd_bo_new(pMsm->dev, 0x81000,
+			DRM_FREEDRENO_GEM_TYPE_KMEM);
+
+	pMsm->ring.state = new_state(pMsm);
+	if (!pMsm->ring.state)
+		return FALSE;
+
+	next_ring(pMsm);
+	if (!pMsm->ring.ring)
+		return FALSE;
+	ring_pre(pMsm->ring.ring);
+
+	out_context(pMsm);
+	END_RING(pMsm);
+
+	return TRUE;
+}
+
+/* throw away everything setup_2d() and next_ring() built up, along with
+ * whatever rendering was still queued:
+ */
+static void
+teardown_2d(MSMPtr pMsm)
+{
+	int i;
+
+	if (pMsm->ring.ring) {
+		del_ring(pMsm, pMsm->ring.ring);
+		pMsm->ring.ring = NULL;
+	}
+
+	while (pMsm->ring.nbusy > 0)
+		del_ring(pMsm, pop_busy(pMsm));
+	pMsm->ring.busy_head = 0;
+
+	while (pMsm->ring.nidle > 0)
+		del_ring(pMsm, pMsm->ring.idle[--pMsm->ring.nidle]);
+
+	if (pMsm->ring.state) {
+		fd_ringbuffer_del(pMsm->ring.state);
+		pMsm->ring.state = NULL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(pMsm->ring.context_bos); i++) {
+		if (pMsm->ring.context_bos[i]) {
+			fd_bo_del(pMsm->ring.context_bos[i]);
+			pMsm->ring.context_bos[i] = NULL;
+		}
+	}
+
+	if (pMsm->ring.scratch) {
+		fd_bo_del(pMsm->ring.scratch);
+		pMsm->ring.scratch = NULL;
+	}
+
+	pMsm->ring.fire = FALSE;
+	pMsm->ring.full_flushes = 0;
+}
+
+/* the gpu is hung: start over with a new pipe, context and ringbuffers.
+ * If even that doesn't work, give up on the gpu and render in software
+ * from here on:
+ */
+static void
+recover(ScrnInfoPtr pScrn)
+{
+	MSMPtr pMsm = MSMPTR(pScrn);
+	uint64_t start = msm_time_us();
+
+	ERROR_MSG("GPU hang: timestamp %u not retired after %ums (last retired "
+			"%u, last submitted %u), resetting the 2D pipe",
+			pMsm->ring.hang_timestamp,
+			(uint32_t)((start - pMsm->ring.hang_start) / 1000),
+			pMsm->ring.retired, pMsm->ring.timestamp);
+
+	teardown_2d(pMsm);
+	fd_pipe_del(pMsm->pipe);
+
+	/* timestamps start over with the new pipe, and what was queued on
+	 * the old one is gone, so push all the serials pixmaps know about
+	 * out of the table and count them as retired:
+	 */
+	memset(pMsm->ring.serial_timestamps, 0,
+			sizeof(pMsm->ring.serial_timestamps));
+	pMsm->ring.serial += MSM_SERIALS;
+	pMsm->ring.timestamp = pMsm->ring.retired = 0;
+	pMsm->ring.hung = FALSE;
+
+	pMsm->pipe = fd_pipe_new(pMsm->dev, FD_PIPE_2D);
+	if (pMsm->pipe && setup_2d(pMsm)) {
+		/* make sure the new pipe actually gets things done: */
+		FIRE_RING(pMsm, FLUSH_SYNC);
+		msm_pipe_wait(pMsm, pMsm->ring.timestamp, WAIT_RECOVER);
+		if (!pMsm->ring.hung) {
+			pMsm->ring.recoveries++;
+			INFO_MSG("GPU recovered in %ums",
+					(uint32_t)((msm_time_us() - start) / 1000));
+			return;
+		}
+		teardown_2d(pMsm);
+	}
+
+	ERROR_MSG("GPU still unusable after %ums, falling back to software!",
+			(uint32_t)((msm_time_us() - start) / 1000));
+
+	pMsm->ring.hung = FALSE;
+	pMsm->ring.lost = TRUE;
+	MSMDisableExa(pMsm);
+
+	/* like fbdev mode, we still need a pipe for cpu_prep: */
+	if (!pMsm->pipe)
+		pMsm->pipe = fd_pipe_new(pMsm->dev, FD_PIPE_3D);
+}
+
+/* has the submit of the i'th busy list entry completed?  Asked of the
+ * kernel without blocking, through its probe bo: that is idle once the
+ * last submit referencing it is done, which can't be an earlier one:
+ */
+static Bool
+busy_retired(MSMPtr pMsm, int i)
+{
+	uint32_t timestamp = pMsm->ring.busy[i].timestamp;
+
+	if (timestamp_retired(pMsm, timestamp))
+		return TRUE;
+
+#ifdef DRM_FREEDRENO_PREP_NOSYNC
+	if (pMsm->ring.busy[i].probe &&
+			!fd_bo_cpu_prep(pMsm->ring.busy[i].probe, pMsm->pipe,
+					DRM_FREEDRENO_PREP_READ |
+					DRM_FREEDRENO_PREP_NOSYNC)) {
+		fd_bo_cpu_fini(pMsm->ring.busy[i].probe);
+		note_retired(pMsm, timestamp);
+		return TRUE;
+	}
+#endif
+
+	return FALSE;
+}
+
+/* move any ringbuffers the gpu has finished with to the idle list.  The
+ * busy list is in submit order, so if the newest is done they all are,
+ * otherwise they are done up to the first one which is still busy:
+ */
+static void
+retire_rings(MSMPtr pMsm)
+{
+	int newest;
+
+	if (!pMsm->ring.nbusy)
+		return;
+
+	newest = (pMsm->ring.busy_head + pMsm->ring.nbusy - 1) % MSM_MAX_RINGS;
+	if (!busy_retired(pMsm, newest))
+		busy_retired(pMsm, pMsm->ring.busy_head);
+
+	while ((pMsm->ring.nbusy > 0) && timestamp_retired(pMsm,
+			pMsm->ring.busy[pMsm->ring.busy_head].timestamp))
+		pMsm->ring.idle[pMsm->ring.nidle++] = pop_busy(pMsm);
+}
+
+/* a ringbuffer left over from before the ringbuffer size changed is
+ * swapped for one of the new size, or kept if we can't:
+ */
+static struct fd_ringbuffer *
+resize_ring(MSMPtr pMsm, struct fd_ringbuffer *ring)
+{
+	struct fd_ringbuffer *resized;
+
+	if (ring->size == ring_size(pMsm))
+		return ring;
+
+	resized = new_ring(pMsm);
+	if (!resized)
+		return ring;
+
+	del_ring(pMsm, ring);
+
+	return resized;
+}
+
+static struct fd_ringbuffer *
+get_ring(MSMPtr pMsm)
+{
+	struct fd_ringbuffer *ring = NULL;
+	int head;
+
+	retire_rings(pMsm);
+
+	/* most recently retired first, it is the most likely to still be
+	 * in cache:
+	 */
+	if (pMsm->ring.nidle > 0)
+		return resize_ring(pMsm, pMsm->ring.idle[--pMsm->ring.nidle]);
+
+	if (pMsm->ring.nrings < pMsm->ring.max_rings)
+		ring = new_ring(pMsm);
+
+	if (!ring && (pMsm->ring.nbusy > 0)) {
+		/* the pool is used up, so there is nothing left but to wait
+		 * for the oldest submit to complete:
+		 */
+		head = pMsm->ring.busy_head;
+		msm_pipe_wait(pMsm, pMsm->ring.busy[head].timestamp, WAIT_RING);
+		ring = resize_ring(pMsm, pop_busy(pMsm));
+	}
+
+	return ring;
+}
+
+/* grow the ringbuffer size if we keep having to flush because the
+ * ringbuffer is (nearly) full:
+ */
+static void
+ring_adapt(MSMPtr pMsm, struct fd_ringbuffer *ring)
+{
+	uint32_t used  = ring->cur - &ring->start[STATE_SIZE];
+	uint32_t avail = ring->end - &ring->start[STATE_SIZE];
+
+	if ((used * 4) < (avail * 3)) {
+		pMsm->ring.full_flushes = 0;
+		return;
+	}
+
+	if ((++pMsm->ring.full_flushes >= RING_GROW_FLUSHES) &&
+			(pMsm->ring.size < pMsm->ring.max_size)) {
+		pMsm->ring.size = min(pMsm->ring.size * 2, pMsm->ring.max_size);
+		pMsm->ring.full_flushes = 0;
+	}
+}
+
+/* after a while without any rendering, give back the extra ringbuffers
+ * and go back to the minimum ringbuffer size:
+ */
+static CARD32
+ring_idle_timer(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+	MSMPtr pMsm = arg;
+
+	/* the last submit has long completed by now, but we may not have
+	 * heard, so this shouldn't block:
+	 */
+	if (pMsm->ring.timestamp &&
+			!timestamp_retired(pMsm, pMsm->ring.timestamp))
+		msm_pipe_wait(pMsm, pMsm->ring.timestamp, WAIT_IDLE);
+	retire_rings(pMsm);
+
+	while ((pMsm->ring.nidle > 0) &&
+			(pMsm->ring.nrings > pMsm->ring.min_rings))
+		del_ring(pMsm, pMsm->ring.idle[--pMsm->ring.nidle]);
+
+	pMsm->ring.size = pMsm->ring.min_size;
+	pMsm->ring.full_flushes = 0;
+
+	return 0;
+}
+
+void
+next_ring(MSMPtr pMsm)
+{
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+	int tail, i;
+
+	/* the ringbuffer we just flushed goes to the back of the busy list,
+	 * with any of the bos it referenced as its probe:
+	 */
+	if (ring) {
+		ring_adapt(pMsm, ring);
+
+		tail = (pMsm->ring.busy_head + pMsm->ring.nbusy) % MSM_MAX_RINGS;
+		pMsm->ring.busy[tail].ring = ring;
+		pMsm->ring.busy[tail].timestamp = pMsm->ring.timestamp;
+		pMsm->ring.busy[tail].probe = NULL;
+		for (i = 0; i < pMsm->ring.shadow.nbos; i++) {
+			if (pMsm->ring.shadow.bos[i].bo) {
+				pMsm->ring.busy[tail].probe =
+						fd_bo_ref(pMsm->ring.shadow.bos[i].bo);
+				break;
+			}
+		}
+		pMsm->ring.nbusy++;
+	}
+
+	/* each ringbuffer starts from the initial state: */
+	shadow_reset(pMsm);
+
+	/* only fails when there is no ringbuffer at all yet: */
+	ring = pMsm->ring.ring = get_ring(pMsm);
+	if (!ring)
+		return;
+
 	fd_ringbuffer_reset(ring);
+
+	/* (re)arm the timer to trim the pool once we go idle: */
+	pMsm->ring.idle_timer = TimerSet(pMsm->ring.idle_timer, 0,
+			RING_IDLE_TIME, ring_idle_timer, pMsm);
 }
 
 Bool
@@ -193,7 +678,8 @@ MSMSetupAccel(ScreenPtr pScreen)
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	MSMPtr pMsm = MSMPTR(pScrn);
 	Bool ret, softexa = FALSE;
-	struct fd_ringbuffer *ring;
+
+	msm_stats_init(pScrn);
 
 	pMsm->pipe = fd_pipe_new(pMsm->dev, FD_PIPE_2D);
 #ifdef HAVE_XA
@@ -240,28 +726,21 @@ no_xa:
 		softexa = TRUE;
 	}
 
-	pMsm->ring.context_bos[0] = fd_bo_new(pMsm->dev, 0x1000,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
-	pMsm->ring.context_bos[1] = fd_bo_new(pMsm->dev, 0x9000,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
-	pMsm->ring.context_bos[2] = fd_bo_new(pMsm->dev, 0x81000,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
-
-	next_ring(pMsm);
-
-	ring = pMsm->ring.ring;
-	ring_pre(ring);
+	pMsm->ring.serial = 1;
+	if (!setup_2d(pMsm)) {
+		ERROR_MSG("could not allocate state ringbuffer, falling back to software!");
+		softexa = TRUE;
+		goto out;
+	}
 
-	BEGIN_RING(pMsm, 8);
-	OUT_RING  (ring, REGM(VGV1_DIRTYBASE, 3));
-	OUT_RELOC (ring, pMsm->ring.context_bos[0], TRUE); /* VGV1_DIRTYBASE */
-	OUT_RELOC (ring, pMsm->ring.context_bos[1], TRUE); /* VGV1_CBASE1 */
-	OUT_RELOC (ring, pMsm->ring.context_bos[2], TRUE); /* VGV1_UBASE2 */
-	OUT_RING  (ring, 0x11000000);
-	OUT_RING  (ring, 0x10fff000);
-	OUT_RING  (ring, 0x10ffffff);
-	OUT_RING  (ring, 0x0d000404);
-	END_RING  (pMsm);
+#ifdef HAVE_XA
+	if (pMsm->HybridAccel && !softexa) {
+		if (MSMSetupHybridXA(pScreen))
+			INFO_MSG("using 2D, and 3D/XA for what 2D can't do");
+		else
+			ERROR_MSG("could not setup XA, using 2D only");
+	}
+#endif
 
 out:
 #ifdef HAVE_XA
@@ -286,6 +765,175 @@ MSMFlushAccel(ScreenPtr pScreen)
 		MSMFlushXA(pMsm);
 #endif
 	} else {
-		FIRE_RING(pMsm);
+		FIRE_RING(pMsm, FLUSH_SYNC);
+#ifdef HAVE_XA
+		if (pMsm->hybrid)
+			MSMHybridFlush(pMsm, FALSE);
+#endif
+	}
+}
+
+static CARD32
+flush_timer(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+	ScrnInfoPtr pScrn = arg;
+	MSMPtr pMsm = MSMPTR(pScrn);
+	uint32_t age;
+
+	if (!pScrn->vtSema || !pMsm->ring.fire)
+		return 0;
+
+	/* what is queued now may be newer than what we were armed for: */
+	age = (msm_time_us() - pMsm->ring.pending) / 1000;
+	if (age < pMsm->ring.flush_deadline)
+		return pMsm->ring.flush_deadline - age;
+
+	FIRE_RING(pMsm, FLUSH_DEADLINE);
+
+	return 0;
+}
+
+/* called from the BlockHandler, decides whether queued rendering is
+ * submitted now or held back for more to batch up with it:
+ */
+void
+MSMBlockAccel(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	MSMPtr pMsm = MSMPTR(pScrn);
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+	uint32_t used, avail, age;
+
+	if (pMsm->xa) {
+		MSMFlushAccel(pScreen);
+		return;
+	}
+
+#ifdef HAVE_XA
+	/* XA is not held back, it only batches up what it can on its own: */
+	if (pMsm->hybrid)
+		MSMHybridFlush(pMsm, FALSE);
+#endif
+
+	if (pMsm->ring.hung)
+		recover(pScrn);
+
+	if (!pMsm->ring.fire)
+		return;
+
+	if (pMsm->ring.flush_now) {
+		FIRE_RING(pMsm, FLUSH_SCANOUT);
+		return;
+	}
+
+	used  = ring->cur - &ring->start[STATE_SIZE];
+	avail = ring->end - &ring->start[STATE_SIZE];
+	if ((used * 100) >= (avail * pMsm->ring.flush_threshold)) {
+		FIRE_RING(pMsm, FLUSH_THRESHOLD);
+		return;
+	}
+
+	age = (msm_time_us() - pMsm->ring.pending) / 1000;
+	if (age >= pMsm->ring.flush_deadline) {
+		FIRE_RING(pMsm, FLUSH_DEADLINE);
+		return;
+	}
+
+	/* make sure it still goes out in time if nothing else wakes us: */
+	pMsm->ring.deferred++;
+	pMsm->ring.flush_timer = TimerSet(pMsm->ring.flush_timer, 0,
+			pMsm->ring.flush_deadline - age, flush_timer, pScrn);
+}
+
+/* on LeaveVT, get the gpu idle before someone else gets it.  The pool
+ * of ringbuffers (all idle now) and the ringbuffer size are kept as they
+ * are, so there is no ramping back up when we return:
+ */
+void
+MSMSuspendAccel(ScrnInfoPtr pScrn)
+{
+	MSMPtr pMsm = MSMPTR(pScrn);
+	uint64_t start = msm_time_us();
+
+	if (pMsm->xa) {
+#ifdef HAVE_XA
+		MSMFlushXA(pMsm);
+#endif
+		return;
 	}
+
+#ifdef HAVE_XA
+	if (pMsm->hybrid)
+		MSMHybridFlush(pMsm, TRUE);
+#endif
+
+	if (!pMsm->ring.ring || pMsm->ring.lost)
+		return;
+
+	FIRE_RING(pMsm, FLUSH_SYNC);
+	msm_pipe_wait(pMsm, pMsm->ring.timestamp, WAIT_SUSPEND);
+	retire_rings(pMsm);
+
+	/* nothing is queued, and the idle pool should not be trimmed while
+	 * we are away:
+	 */
+	TimerCancel(pMsm->ring.flush_timer);
+	TimerCancel(pMsm->ring.idle_timer);
+
+	pMsm->ring.suspended = TRUE;
+
+	DEBUG_MSG("gpu idle after %uus, %d ringbuffers kept",
+			(uint32_t)(msm_time_us() - start), pMsm->ring.nrings);
+}
+
+/* on EnterVT, whoever had the gpu meanwhile may have left it with other
+ * context bases.  Rather than submitting anything now, the context setup
+ * goes at the start of the current (empty) ringbuffer, without
+ * END_RING(), so it only goes out along with the first rendering:
+ */
+void
+MSMResumeAccel(ScrnInfoPtr pScrn)
+{
+	MSMPtr pMsm = MSMPTR(pScrn);
+
+	if (!pMsm->ring.suspended)
+		return;
+
+	pMsm->ring.suspended = FALSE;
+
+	if (!pMsm->ring.ring || pMsm->ring.lost)
+		return;
+
+	out_context(pMsm);
+
+	pMsm->ring.idle_timer = TimerSet(pMsm->ring.idle_timer, 0,
+			RING_IDLE_TIME, ring_idle_timer, pMsm);
+}
+
+void
+MSMCloseAccel(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	MSMPtr pMsm = MSMPTR(pScrn);
+
+	if (pMsm->ring.idle_timer) {
+		TimerFree(pMsm->ring.idle_timer);
+		pMsm->ring.idle_timer = NULL;
+	}
+
+	if (pMsm->ring.flush_timer) {
+		TimerFree(pMsm->ring.flush_timer);
+		pMsm->ring.flush_timer = NULL;
+	}
+
+	/* the pooled ringbuffers and context bos can only go once the gpu
+	 * is done with them.  What is still queued is just dropped:
+	 */
+	if (pMsm->ring.ring && pMsm->ring.timestamp)
+		msm_pipe_wait(pMsm, pMsm->ring.timestamp, WAIT_CLOSE);
+	teardown_2d(pMsm);
+
+	msm_capture_reset();
+
+	msm_stats_dump(pScrn);
 }
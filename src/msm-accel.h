@@ -35,6 +35,23 @@
 void ring_pre(struct fd_ringbuffer *ring);
 void ring_post(struct fd_ringbuffer *ring);
 void next_ring(MSMPtr pMsm);
+void msm_pipe_wait(MSMPtr pMsm, uint32_t timestamp, enum msm_wait_site site);
+void msm_serial_wait(MSMPtr pMsm, uint32_t serial, enum msm_wait_site site);
+
+extern struct msm_capture *msmCapture;
+Bool msm_capture_init(ScrnInfoPtr pScrn, const char *path);
+void msm_capture_reset(void);
+void msm_capture_reloc(struct fd_ringbuffer *ring, struct fd_bo *bo, Bool write);
+void msm_capture_ring(MSMPtr pMsm, struct fd_ringbuffer *ring);
+void msm_capture_bo_dirty(struct fd_bo *bo);
+void msm_capture_forget_bo(struct fd_bo *bo);
+
+uint64_t msm_time_us(void);
+void msm_stats_add(struct msm_wait_stats *stats, uint32_t us);
+void msm_stats_wait(MSMPtr pMsm, enum msm_wait_site site, uint64_t start);
+void msm_stats_init(ScrnInfoPtr pScrn);
+void msm_stats_poll(ScrnInfoPtr pScrn);
+void msm_stats_dump(ScrnInfoPtr pScrn);
 
 static inline void
 OUT_RING(struct fd_ringbuffer *ring, unsigned data)
@@ -53,42 +70,198 @@ OUT_RELOC(struct fd_ringbuffer *ring, struct fd_bo *bo, Bool write)
 		ErrorF("ring[%p]: OUT_RELOC  %04x:  %p\n", ring,
 				(uint32_t)(ring->cur - ring->last_start), bo);
 	}
+	if (msmCapture)
+		msm_capture_reloc(ring, bo, write);
 	fd_ringbuffer_reloc(ring, &(struct fd_reloc){
 		.bo = bo,
 		.flags = FD_RELOC_READ | (write ? FD_RELOC_WRITE : 0),
 	});
 }
 
+/* emit a block of dwords in one go, for the fixed parts of packets: */
+static inline void
+OUT_RINGS(struct fd_ringbuffer *ring, const uint32_t *dwords, int n)
+{
+	if (LOG_DWORDS) {
+		int i;
+		for (i = 0; i < n; i++) {
+			ErrorF("ring[%p]: OUT_RINGS  %04x:  %08x\n", ring,
+					(uint32_t)(ring->cur - ring->last_start) + i,
+					dwords[i]);
+		}
+	}
+	memcpy(ring->cur, dwords, n * sizeof(uint32_t));
+	ring->cur += n;
+}
+
+
+static inline void
+shadow_reset(MSMPtr pMsm)
+{
+	memset(&pMsm->ring.shadow, 0, sizeof(pMsm->ring.shadow));
+}
+
+static inline void
+shadow_invalidate(MSMPtr pMsm, enum z1xx_reg reg)
+{
+	pMsm->ring.shadow.valid[reg / 32] &= ~(1 << (reg % 32));
+}
+
+/* forget any cached state referring to the bo, in case the same fd_bo
+ * pointer gets recycled for a different buffer before the next flush:
+ */
+static inline void
+shadow_forget_bo(MSMPtr pMsm, struct fd_bo *bo)
+{
+	int i;
+
+	if (pMsm->ring.shadow.dst == bo)
+		pMsm->ring.shadow.dst = NULL;
+
+	for (i = 0; i < pMsm->ring.shadow.nbos; i++)
+		if (pMsm->ring.shadow.bos[i].bo == bo)
+			pMsm->ring.shadow.bos[i].bo = NULL;
+}
+
+/* returns TRUE if the register does not already hold the value in the
+ * current ringbuffer (and records the new value):
+ */
+static inline Bool
+shadow_update(MSMPtr pMsm, enum z1xx_reg reg, uint32_t val)
+{
+	uint32_t bit = 1 << (reg % 32);
+
+	if ((pMsm->ring.shadow.valid[reg / 32] & bit) &&
+			(pMsm->ring.shadow.val[reg] == val))
+		return FALSE;
+
+	pMsm->ring.shadow.valid[reg / 32] |= bit;
+	pMsm->ring.shadow.val[reg] = val;
+
+	return TRUE;
+}
+
+/* reference a bo from the current ringbuffer.  The same bos get referenced
+ * over and over within a submit (the dst twice for every op, for one).
+ * With kgsl, the only backend with the 2D pipe, a reloc just resolves to
+ * the bo's gpu address and adds the bo to the submit's bo list, which the
+ * first reloc of the bo already did.  So the later ones just reuse the
+ * address, rather than going through fd_ringbuffer_reloc() again:
+ */
+static inline void
+OUT_BO(MSMPtr pMsm, struct fd_bo *bo, Bool write)
+{
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+	int i, n = pMsm->ring.shadow.nbos;
+
+	for (i = 0; i < n; i++)
+		if (pMsm->ring.shadow.bos[i].bo == bo)
+			break;
+
+	/* a write reloc can stand in for a read, but not the other way: */
+	if ((i < n) && (pMsm->ring.shadow.bos[i].write || !write)) {
+		/* a replay has to relocate every reference: */
+		if (msmCapture)
+			msm_capture_reloc(ring, bo, write);
+		pMsm->ring.reloc_dups++;
+		OUT_RING(ring, pMsm->ring.shadow.bos[i].addr);
+		return;
+	}
+
+	OUT_RELOC(ring, bo, write);
+	pMsm->ring.relocs++;
+
+	if (i == n) {
+		if (n == ARRAY_SIZE(pMsm->ring.shadow.bos))
+			return;
+		pMsm->ring.shadow.nbos++;
+	}
+
+	pMsm->ring.shadow.bos[i].bo = bo;
+	pMsm->ring.shadow.bos[i].addr = ring->cur[-1];
+	pMsm->ring.shadow.bos[i].write = write;
+}
+
+/* OUT_BO() into a slot already reserved (by OUT_RINGS()) earlier in the
+ * ringbuffer:
+ */
 static inline void
-FIRE_RING(MSMPtr pMsm)
+OUT_BO_AT(MSMPtr pMsm, uint32_t *slot, struct fd_bo *bo, Bool write)
+{
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+	uint32_t *cur = ring->cur;
+	ring->cur = slot;
+	OUT_BO(pMsm, bo, write);
+	ring->cur = cur;
+}
+
+/* write a single register, skipped if the shadow says it already holds
+ * the value.  Only for registers which are plain state, not for ones
+ * like G2D_GRADIENT or G2D_XY whose writes have side effects, nor for
+ * G2D_INPUT, which is written in sequences on purpose.
+ */
+static inline void
+OUT_REG(MSMPtr pMsm, enum z1xx_reg reg, uint32_t val)
+{
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+
+	if (!shadow_update(pMsm, reg, val))
+		return;
+
+	/* values which don't fit in 24 bits need the REGM form: */
+	if (val & 0xff000000) {
+		OUT_RING(ring, REGM(reg, 1));
+		OUT_RING(ring, val);
+	} else {
+		OUT_RING(ring, REG(reg) | val);
+	}
+}
+
+static inline void
+FIRE_RING(MSMPtr pMsm, enum msm_flush_reason reason)
 {
 	struct fd_ringbuffer *ring = pMsm->ring.ring;
 	if (pMsm->ring.fire) {
 		ring_post(ring);
+
+		if (msmCapture)
+			msm_capture_ring(pMsm, ring);
+
+		pMsm->ring.submits++;
+		pMsm->ring.submit_dwords += ring->cur - ring->last_start;
+		pMsm->ring.flushes[reason]++;
+		msm_stats_add(&pMsm->ring.latency,
+				msm_time_us() - pMsm->ring.pending);
+
 		fd_ringbuffer_flush(ring);
 
 		/* grab the timestamp off the current ringbuffer: */
 		pMsm->ring.timestamp = fd_ringbuffer_timestamp(pMsm->ring.ring);
+		pMsm->ring.serial_timestamps[pMsm->ring.serial % MSM_SERIALS] =
+				pMsm->ring.timestamp;
+		pMsm->ring.serial++;
 
-		/* cycle to next ringbuffer: */
-		next_ring(pMsm);
-
-		/* if blits haven't finished on the previous usage of the next
-		 * ringbuffer, we need to wait to avoid overwriting cmds that
-		 * the gpu is still processing..  ideally we don't hit this too
-		 * much, otherwise we should create more ringbuffers..
-		 *
-		 * TODO maybe we want to time this to make sure we aren't actually
-		 * blocking..
+		/* cycle to next ringbuffer.  This only blocks if all the
+		 * ringbuffers are still in use by the gpu:
 		 */
-		fd_pipe_wait(pMsm->pipe, fd_ringbuffer_timestamp(pMsm->ring.ring));
+		next_ring(pMsm);
 
 		ring_pre(pMsm->ring.ring);
 
 		pMsm->ring.fire = FALSE;
+		pMsm->ring.flush_now = FALSE;
 	}
 }
 
+/* serial of the latest submit with rendering in it, which is the one
+ * being built unless nothing has been emitted since the last submit:
+ */
+static inline uint32_t
+last_serial(MSMPtr pMsm)
+{
+	return pMsm->ring.serial - !pMsm->ring.fire;
+}
+
 static inline void
 BEGIN_RING(MSMPtr pMsm, int size)
 {
@@ -98,11 +271,15 @@ BEGIN_RING(MSMPtr pMsm, int size)
 		ErrorF("ring[%p]: BEGIN_RING %d\n", ring, size);
 	}
 
-	/* current kernel side just expects one cmd packet per ISSUEIBCMDS: */
-	size += 11;       /* common header/footer */
+	/* current kernel side just expects one cmd packet per ISSUEIBCMDS,
+	 * so the header is emitted once per ringbuffer by ring_pre() (and
+	 * is already accounted for in ring->cur).  We only need to leave
+	 * room for the footer:
+	 */
+	size += 3;        /* ring_post() */
 
 	if ((ring->cur + size) > ring->end)
-		FIRE_RING(pMsm);
+		FIRE_RING(pMsm, FLUSH_FULL);
 }
 
 static inline void
@@ -112,7 +289,19 @@ END_RING(MSMPtr pMsm)
 	if (LOG_DWORDS) {
 		ErrorF("ring[%p]: END_RING\n", ring);
 	}
+	if (!pMsm->ring.fire)
+		pMsm->ring.pending = msm_time_us();
 	pMsm->ring.fire = TRUE;
 }
 
+/* rendering to the scanout is visible, so don't hold it back for the
+ * flush deadline:
+ */
+static inline void
+ring_dst(MSMPtr pMsm, struct fd_bo *bo)
+{
+	if (bo == pMsm->scanout)
+		pMsm->ring.flush_now = TRUE;
+}
+
 #endif /* MSM_ACCEL_H_ */
@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "msm.h"
+#include "msm-accel.h"
+#include "msm-capture.h"
+
+/* Capture of the command stream, for offline replay with tools/fdreplay.
+ * Enabled with Option "CaptureFile".  Each flushed ringbuffer is written
+ * out along with its relocs, and a snapshot of each bo the first time it
+ * is referenced and again after any cpu access.  Snapshots are taken
+ * without waiting for the gpu, so a bo which is still being rendered to
+ * may be captured in an intermediate state.
+ */
+
+struct capture_bo_entry {
+	struct fd_bo *bo;
+	uint32_t id;
+	Bool dirty;
+};
+
+struct capture_reloc_entry {
+	struct fd_ringbuffer *ring;
+	struct fd_bo *bo;       /* or NULL if already resolved to id */
+	uint32_t id, offset, flags;
+};
+
+struct msm_capture {
+	FILE *f;
+	uint32_t next_id;
+
+	struct capture_bo_entry *bos;
+	int nbos, maxbos;
+
+	/* relocs emitted since the ringbuffer they belong to was flushed: */
+	struct capture_reloc_entry *relocs;
+	int nrelocs, maxrelocs;
+};
+
+struct msm_capture *msmCapture;
+
+static Bool
+write_block(uint32_t type, const void *hdr, uint32_t hdrsize,
+		const void *data, uint32_t datasize)
+{
+	FILE *f = msmCapture->f;
+	struct capture_block block = {
+			.type = type,
+			.size = hdrsize + datasize,
+	};
+
+	if (fwrite(&block, sizeof(block), 1, f) != 1)
+		return FALSE;
+	if (fwrite(hdr, hdrsize, 1, f) != 1)
+		return FALSE;
+	if (datasize && (fwrite(data, datasize, 1, f) != 1))
+		return FALSE;
+
+	return TRUE;
+}
+
+/* returns the bo's capture id, writing out a snapshot of the bo first if
+ * it is new or dirty:
+ */
+static Bool
+capture_bo(struct fd_bo *bo, uint32_t *id)
+{
+	struct msm_capture *c = msmCapture;
+	struct capture_bo_entry *entry = NULL;
+	struct capture_bo hdr;
+	void *ptr;
+	int i;
+
+	for (i = 0; i < c->nbos; i++) {
+		if (c->bos[i].bo == bo) {
+			entry = &c->bos[i];
+			break;
+		}
+	}
+
+	if (!entry) {
+		if (c->nbos == c->maxbos) {
+			int max = max(64, c->maxbos * 2);
+			void *bos = realloc(c->bos, max * sizeof(c->bos[0]));
+			if (!bos)
+				return FALSE;
+			c->bos = bos;
+			c->maxbos = max;
+		}
+		entry = &c->bos[c->nbos++];
+		entry->bo = bo;
+		entry->id = c->next_id++;
+		entry->dirty = TRUE;
+	}
+
+	*id = entry->id;
+
+	if (!entry->dirty)
+		return TRUE;
+
+	ptr = fd_bo_map(bo);
+
+	hdr.id = entry->id;
+	hdr.size = fd_bo_size(bo);
+	hdr.flags = ptr ? CAPTURE_BO_CONTENTS : 0;
+
+	if (!write_block(CAPTURE_BO, &hdr, sizeof(hdr), ptr, ptr ? hdr.size : 0))
+		return FALSE;
+
+	entry->dirty = FALSE;
+
+	return TRUE;
+}
+
+static Bool
+capture_ring(MSMPtr pMsm, struct fd_ringbuffer *ring)
+{
+	struct msm_capture *c = msmCapture;
+	struct capture_reloc *relocs;
+	struct capture_ring hdr;
+	Bool ret = TRUE;
+	int i, j, n = 0;
+
+	relocs = malloc(c->nrelocs * sizeof(relocs[0]));
+	if (c->nrelocs && !relocs)
+		return FALSE;
+
+	/* the ringbuffer's state was copied from the state template, so
+	 * the template's relocs apply to it too:
+	 */
+	for (i = 0; i < c->nrelocs; i++) {
+		struct capture_reloc_entry *r = &c->relocs[i];
+		if ((r->ring != ring) && (r->ring != pMsm->ring.state))
+			continue;
+		if (!r->bo) {
+			relocs[n].bo = r->id;
+		} else if (!capture_bo(r->bo, &relocs[n].bo)) {
+			ret = FALSE;
+			goto out;
+		}
+		relocs[n].offset = r->offset;
+		relocs[n].flags = r->flags;
+		n++;
+	}
+
+	hdr.ndwords = ring->cur - ring->start;
+	hdr.nrelocs = n;
+	hdr.time_us = msm_time_us();
+
+	if (!write_block(CAPTURE_RING, &hdr, sizeof(hdr), ring->start,
+			hdr.ndwords * sizeof(uint32_t))) {
+		ret = FALSE;
+		goto out;
+	}
+
+	if (n && (fwrite(relocs, sizeof(relocs[0]), n, c->f) != n))
+		ret = FALSE;
+
+out:
+	/* drop the relocs belonging to the ringbuffer we just captured: */
+	for (i = 0, j = 0; i < c->nrelocs; i++)
+		if (c->relocs[i].ring != ring)
+			c->relocs[j++] = c->relocs[i];
+	c->nrelocs = j;
+
+	free(relocs);
+
+	return ret;
+}
+
+Bool
+msm_capture_init(ScrnInfoPtr pScrn, const char *path)
+{
+	struct msm_capture *c;
+	struct capture_header hdr = {
+			.magic = CAPTURE_MAGIC,
+			.version = CAPTURE_VERSION,
+			.pipe = FD_PIPE_2D,
+			.state_size = STATE_SIZE,
+	};
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return FALSE;
+
+	c->f = fopen(path, "w");
+	if (!c->f) {
+		ERROR_MSG("could not open capture file %s: %s", path, strerror(errno));
+		free(c);
+		return FALSE;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, c->f) != 1) {
+		ERROR_MSG("could not write capture file %s", path);
+		fclose(c->f);
+		free(c);
+		return FALSE;
+	}
+
+	c->next_id = 1;
+	msmCapture = c;
+
+	INFO_MSG("capturing command stream to %s", path);
+
+	return TRUE;
+}
+
+/* stop capturing, when we can no longer keep up with it: */
+static void
+msm_capture_fini(void)
+{
+	struct msm_capture *c = msmCapture;
+
+	if (!c)
+		return;
+
+	msmCapture = NULL;
+
+	fclose(c->f);
+	free(c->bos);
+	free(c->relocs);
+	free(c);
+}
+
+/* the screen is going away, along with all of its bos, so forget about
+ * them (the fd_bo pointers may be recycled after a server regeneration)
+ * and get what was captured so far out to the file.  The file itself
+ * stays open, as the option is only read in PreInit, and it gets closed
+ * when the server exits:
+ */
+void
+msm_capture_reset(void)
+{
+	struct msm_capture *c = msmCapture;
+
+	if (!c)
+		return;
+
+	c->nbos = 0;
+	c->nrelocs = 0;
+
+	fflush(c->f);
+}
+
+void
+msm_capture_reloc(struct fd_ringbuffer *ring, struct fd_bo *bo, Bool write)
+{
+	struct msm_capture *c = msmCapture;
+	struct capture_reloc_entry *r;
+
+	if (c->nrelocs == c->maxrelocs) {
+		int max = max(256, c->maxrelocs * 2);
+		void *relocs = realloc(c->relocs, max * sizeof(c->relocs[0]));
+		if (!relocs) {
+			ErrorF("capture: out of memory, capture stopped\n");
+			msm_capture_fini();
+			return;
+		}
+		c->relocs = relocs;
+		c->maxrelocs = max;
+	}
+
+	r = &c->relocs[c->nrelocs++];
+	r->ring = ring;
+	r->bo = bo;
+	r->id = 0;
+	r->offset = ring->cur - ring->start;
+	r->flags = FD_RELOC_READ | (write ? FD_RELOC_WRITE : 0);
+}
+
+void
+msm_capture_ring(MSMPtr pMsm, struct fd_ringbuffer *ring)
+{
+	if (!msmCapture)
+		return;
+
+	if (!capture_ring(pMsm, ring)) {
+		ErrorF("capture: write failed, capture stopped\n");
+		msm_capture_fini();
+	}
+}
+
+/* the cpu (may have) written to the bo, so snapshot it again the next
+ * time it is referenced:
+ */
+void
+msm_capture_bo_dirty(struct fd_bo *bo)
+{
+	struct msm_capture *c = msmCapture;
+	int i;
+
+	if (!c)
+		return;
+
+	for (i = 0; i < c->nbos; i++) {
+		if (c->bos[i].bo == bo) {
+			c->bos[i].dirty = TRUE;
+			break;
+		}
+	}
+}
+
+/* the bo is going away, so if the fd_bo pointer is recycled it must be
+ * treated as a new bo:
+ */
+void
+msm_capture_forget_bo(struct fd_bo *bo)
+{
+	struct msm_capture *c = msmCapture;
+	uint32_t id;
+	int i;
+
+	if (!c)
+		return;
+
+	/* relocs not flushed yet still need the bo, so resolve them (and
+	 * take the snapshot, if needed) while it is still around:
+	 */
+	for (i = 0; i < c->nrelocs; i++) {
+		struct capture_reloc_entry *r = &c->relocs[i];
+		if (r->bo != bo)
+			continue;
+		if (!capture_bo(bo, &id)) {
+			ErrorF("capture: write failed, capture stopped\n");
+			msm_capture_fini();
+			return;
+		}
+		r->bo = NULL;
+		r->id = id;
+	}
+
+	for (i = 0; i < c->nbos; i++) {
+		if (c->bos[i].bo == bo) {
+			c->bos[i] = c->bos[--c->nbos];
+			break;
+		}
+	}
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MSM_CAPTURE_H_
+#define MSM_CAPTURE_H_
+
+/* On-disk format of the command-stream capture files written by the
+ * driver (Option "CaptureFile") and read back by tools/fdreplay.  This
+ * header is shared with the tools, so it must not depend on any of the
+ * xserver headers.
+ *
+ * A capture is a capture_header followed by a sequence of blocks, each
+ * a capture_block giving the type and payload size.  All values are in
+ * host byte order.  A bo block always precedes the first ring block
+ * which references the bo (and is repeated when the cpu has written to
+ * the bo since the last snapshot), so a capture can be replayed in a
+ * single pass.
+ */
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC      0x70616366    /* "fcap" */
+#define CAPTURE_VERSION    1
+
+struct capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pipe;          /* enum fd_pipe_id */
+	uint32_t state_size;    /* dwords of state at the start of each ring */
+};
+
+enum capture_block_type {
+	CAPTURE_BO   = 1,
+	CAPTURE_RING = 2,
+};
+
+struct capture_block {
+	uint32_t type;
+	uint32_t size;          /* payload size in bytes, following */
+};
+
+/* CAPTURE_BO payload, followed by the bo contents if CAPTURE_BO_CONTENTS
+ * is set:
+ */
+struct capture_bo {
+	uint32_t id;
+	uint32_t size;
+	uint32_t flags;
+};
+
+#define CAPTURE_BO_CONTENTS  0x1
+
+/* CAPTURE_RING payload, followed by ndwords dwords and then nrelocs
+ * capture_reloc's.  The dwords cover the whole ringbuffer from the start
+ * (including the state), with the gpu addresses at the reloc offsets
+ * left as they were at capture time:
+ */
+struct capture_ring {
+	uint32_t ndwords;
+	uint32_t nrelocs;
+	uint64_t time_us;       /* CLOCK_MONOTONIC time of the flush */
+};
+
+struct capture_reloc {
+	uint32_t offset;        /* in dwords, from the start of the ring */
+	uint32_t bo;            /* capture_bo id */
+	uint32_t flags;         /* FD_RELOC_x */
+};
+
+#endif /* MSM_CAPTURE_H_ */
@@ -80,6 +80,16 @@ static const OptionInfoRec MSMOptions[] = {
 		{OPTION_SWREFRESHER, "SWRefresher", OPTV_BOOLEAN, {0}, FALSE},
 		{OPTION_VSYNC, "DefaultVsync", OPTV_INTEGER, {0}, FALSE},
 		{OPTION_DEBUG, "Debug", OPTV_BOOLEAN, {0}, FALSE},
+		{OPTION_MIN_RINGS, "MinRings", OPTV_INTEGER, {0}, FALSE},
+		{OPTION_MAX_RINGS, "MaxRings", OPTV_INTEGER, {0}, FALSE},
+		{OPTION_MIN_RING_SIZE, "MinRingSize", OPTV_INTEGER, {0}, FALSE},
+		{OPTION_MAX_RING_SIZE, "MaxRingSize", OPTV_INTEGER, {0}, FALSE},
+		{OPTION_CAPTURE_FILE, "CaptureFile", OPTV_STRING, {0}, FALSE},
+		{OPTION_FLUSH_DEADLINE, "FlushDeadline", OPTV_INTEGER, {0}, FALSE},
+		{OPTION_FLUSH_THRESHOLD, "FlushThreshold", OPTV_INTEGER, {0}, FALSE},
+		{OPTION_HANG_TIMEOUT, "HangTimeout", OPTV_INTEGER, {0}, FALSE},
+		{OPTION_HYBRID, "Hybrid", OPTV_BOOLEAN, {0}, FALSE},
+		{OPTION_RASTER_OPS, "RasterOps", OPTV_BOOLEAN, {0}, FALSE},
 		{-1, NULL, OPTV_NONE, {0}, FALSE}
 };
 
@@ -101,7 +111,9 @@ MSMBlockHandler (BLOCKHANDLER_ARGS_DECL)
 	pScreen->BlockHandler = MSMBlockHandler;
 
 	if (pScrn->vtSema)
-		MSMFlushAccel(pScreen);
+		MSMBlockAccel(pScreen);
+
+	msm_stats_poll(pScrn);
 }
 
 /*
@@ -164,6 +176,8 @@ static Bool
 MSMPreInit(ScrnInfoPtr pScrn, int flags)
 {
 	MSMPtr pMsm;
+	int minsize, maxsize, deadline, threshold, timeout;
+	const char *capture;
 	rgb defaultWeight = { 0, 0, 0 };
 	Gamma zeros = { 0.0, 0.0, 0.0 };
 
@@ -247,12 +261,56 @@ MSMPreInit(ScrnInfoPtr pScrn, int flags)
 	/* NoAccel - default FALSE */
 	pMsm->NoAccel = xf86ReturnOptValBool(pMsm->options, OPTION_NOACCEL, FALSE);
 
+	/* Hybrid - default FALSE */
+	pMsm->HybridAccel = xf86ReturnOptValBool(pMsm->options, OPTION_HYBRID, FALSE);
+
+	/* RasterOps - default FALSE */
+	pMsm->RasterOps = xf86ReturnOptValBool(pMsm->options, OPTION_RASTER_OPS, FALSE);
+
 	/* SWCursor - default FALSE */
 	pMsm->HWCursor = !xf86ReturnOptValBool(pMsm->options, OPTION_SWCURSOR, FALSE);
 
 	/* SWRefresher - default TRUE */
 	pMsm->SWRefresher = xf86ReturnOptValBool(pMsm->options, OPTION_SWREFRESHER, TRUE);
 
+	/* MinRings/MaxRings - default 2 and MSM_MAX_RINGS */
+	pMsm->ring.min_rings = 2;
+	pMsm->ring.max_rings = MSM_MAX_RINGS;
+	xf86GetOptValInteger(pMsm->options, OPTION_MIN_RINGS, &pMsm->ring.min_rings);
+	xf86GetOptValInteger(pMsm->options, OPTION_MAX_RINGS, &pMsm->ring.max_rings);
+	pMsm->ring.max_rings = max(1, min(pMsm->ring.max_rings, MSM_MAX_RINGS));
+	pMsm->ring.min_rings = max(1, min(pMsm->ring.min_rings, pMsm->ring.max_rings));
+
+	/* MinRingSize/MaxRingSize (in kB) - default 16 and 64 */
+	minsize = 16;
+	maxsize = 64;
+	xf86GetOptValInteger(pMsm->options, OPTION_MIN_RING_SIZE, &minsize);
+	xf86GetOptValInteger(pMsm->options, OPTION_MAX_RING_SIZE, &maxsize);
+	minsize = max(4, minsize);
+	maxsize = max(minsize, maxsize);
+	pMsm->ring.size = pMsm->ring.min_size = minsize * 1024;
+	pMsm->ring.max_size = maxsize * 1024;
+
+	/* FlushDeadline (in ms) - default 2, and FlushThreshold (in % of
+	 * the ringbuffer) - default 50
+	 */
+	deadline = 2;
+	threshold = 50;
+	xf86GetOptValInteger(pMsm->options, OPTION_FLUSH_DEADLINE, &deadline);
+	xf86GetOptValInteger(pMsm->options, OPTION_FLUSH_THRESHOLD, &threshold);
+	pMsm->ring.flush_deadline = max(0, deadline);
+	pMsm->ring.flush_threshold = max(0, min(threshold, 100));
+
+	/* HangTimeout (in ms) - default 2000 */
+	timeout = 2000;
+	xf86GetOptValInteger(pMsm->options, OPTION_HANG_TIMEOUT, &timeout);
+	pMsm->ring.hang_timeout = max(0, timeout);
+
+	/* CaptureFile - default none */
+	capture = xf86GetOptValString(pMsm->options, OPTION_CAPTURE_FILE);
+	if (capture)
+		msm_capture_init(pScrn, capture);
+
 	xf86PrintModes(pScrn);
 
 	/* FIXME:  We will probably need to be more exact when setting
@@ -278,6 +336,22 @@ MSMPreInit(ScrnInfoPtr pScrn, int flags)
 
 	INFO_MSG("MSM Options:");
 	INFO_MSG(" HW Cursor: %s", pMsm->HWCursor ? "Enabled" : "Disabled");
+	INFO_MSG(" Rings: %d-%d, %d-%dkB", pMsm->ring.min_rings,
+			pMsm->ring.max_rings, minsize, maxsize);
+	INFO_MSG(" Flush: after %ums, or at %u%% full", pMsm->ring.flush_deadline,
+			pMsm->ring.flush_threshold);
+#ifdef HAVE_FD_PIPE_WAIT_TIMEOUT
+	INFO_MSG(" Hang timeout: %ums", pMsm->ring.hang_timeout);
+#else
+	INFO_MSG(" Hang timeout: unavailable");
+	if (xf86IsOptionSet(pMsm->options, OPTION_HANG_TIMEOUT))
+		WARNING_MSG("HangTimeout ignored, libdrm_freedreno has no "
+				"fd_pipe_wait_timeout() so hangs are not detected");
+#endif
+#ifdef HAVE_XA
+	INFO_MSG(" Hybrid 2D/3D: %s", pMsm->HybridAccel ? "Enabled" : "Disabled");
+#endif
+	INFO_MSG(" Raster ops: %s", pMsm->RasterOps ? "Enabled" : "Disabled");
 
 	return TRUE;
 }
@@ -319,6 +393,8 @@ MSMCloseScreen(CLOSE_SCREEN_ARGS_DECL)
 
 	DEBUG_MSG("close screen");
 
+	MSMCloseAccel(pScreen);
+
 	/* Close DRI2 */
 	if (pMsm->dri) {
 		MSMDRI2CloseScreen(pScreen);
@@ -498,6 +574,8 @@ MSMEnterVT(VT_FUNC_ARGS_DECL)
 			ERROR_MSG("Unable to get master: %s", strerror(errno));
 	}
 
+	MSMResumeAccel(pScrn);
+
 	/* Set up the mode - this doesn't actually touch the hardware,
 	 * but it makes RandR all happy */
 
@@ -517,6 +595,9 @@ MSMLeaveVT(VT_FUNC_ARGS_DECL)
 
 	DEBUG_MSG("leave-vt");
 
+	/* the gpu isn't ours once we drop master: */
+	MSMSuspendAccel(pScrn);
+
 	if (!pMsm->NoKMS) {
 		int ret = drmDropMaster(pMsm->drmFD);
 		if (ret)
@@ -31,6 +31,8 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include "xf86.h"
 #include "exa.h"
 
@@ -54,8 +56,36 @@
 struct exa_state {
 	struct xa_context *ctx;
 	struct xa_composite comp;
+	struct xa_picture src, mask, dst;
+};
+
+/* hybrid mode: the 2D EXA hooks (msm-exa.c) do most of the rendering,
+ * and hand the composites they can't do to XA on the 3D pipe.  Pixmaps
+ * are plain bos then, with an XA surface wrapped around them the first
+ * time XA touches them.
+ *
+ * Neither pipe can wait on the other, so cross-pipe dependencies are
+ * resolved by the cpu: before XA uses a bo, we wait for the 2D submits
+ * which used it (by serial, like PrepareAccess), and before the 2D pipe
+ * or the cpu uses a bo which XA used, XA is flushed and we wait for it
+ * to go idle.  XA rendering is counted in batches between such waits,
+ * which is what the xa serials in the pixmap privs refer to:
+ */
+struct msm_hybrid {
+	struct xa_tracker *xa;
+	struct exa_state exa;
+	/* the batch being built, anything older has retired: */
+	uint32_t serial;
+	/* pixmaps used by the composite set up by PrepareComposite(): */
+	struct msm_pixmap_priv *dst, *src, *mask;
 };
 
+#define HYBRID_LOCALS(pDraw) \
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(((DrawablePtr)(pDraw))->pScreen); \
+    MSMPtr pMsm = MSMPTR(pScrn);                                    \
+    struct msm_hybrid *hybrid = pMsm->hybrid;                       \
+    struct exa_state *exa = &hybrid->exa; (void)exa
+
 /**
  * PrepareSolid() sets up the driver for doing a solid fill.
  * @param pPixmap Destination pixmap
@@ -226,12 +256,96 @@ XADoneCopy(PixmapPtr pDstPixmap)
 	xa_copy_done(exa->ctx);
 }
 
+static const struct {
+	PictFormatShort pict;
+	enum xa_formats xa;
+} xa_formats[] = {
+		{ PICT_a8r8g8b8, xa_format_a8r8g8b8 },
+		{ PICT_x8r8g8b8, xa_format_x8r8g8b8 },
+		{ PICT_r5g6b5,   xa_format_r5g6b5 },
+		{ PICT_x1r5g5b5, xa_format_x1r5g5b5 },
+		{ PICT_a8,       xa_format_a8 },
+};
+
 static Bool
-xa_setup_composite(struct xa_composite *comp, int op, PicturePtr pSrcPicture,
+xa_setup_picture(struct xa_picture *xp, PicturePtr pict)
+{
+	PictTransformPtr t = pict->transform;
+	int i;
+
+	/* no solid/gradient source pictures, or alpha maps: */
+	if (!pict->pDrawable || pict->alphaMap)
+		return FALSE;
+
+	memset(xp, 0, sizeof(*xp));
+
+	for (i = 0; i < ARRAY_SIZE(xa_formats); i++)
+		if (xa_formats[i].pict == pict->format)
+			xp->pict_format = xa_formats[i].xa;
+	if (xp->pict_format == xa_format_unknown)
+		return FALSE;
+
+	if (!pict->repeat)
+		xp->wrap = xa_wrap_clamp_to_border;
+	else if (pict->repeatType == RepeatNormal)
+		xp->wrap = xa_wrap_repeat;
+	else if (pict->repeatType == RepeatReflect)
+		xp->wrap = xa_wrap_mirror_repeat;
+	else if (pict->repeatType == RepeatPad)
+		xp->wrap = xa_wrap_clamp_to_edge;
+	else
+		xp->wrap = xa_wrap_clamp_to_border;
+
+	if (pict->filter == PictFilterNearest)
+		xp->filter = xa_filter_nearest;
+	else if (pict->filter == PictFilterBilinear)
+		xp->filter = xa_filter_linear;
+	else
+		return FALSE;
+
+	/* XA wants the matrix column-major: */
+	if (t) {
+		for (i = 0; i < 9; i++)
+			xp->transform[i] = xFixedtoDouble(t->matrix[i % 3][i / 3]);
+		xp->has_transform = 1;
+	}
+
+	xp->component_alpha = pict->componentAlpha;
+
+	return TRUE;
+}
+
+/* fill in exa->comp, all but the surfaces, which are only known once
+ * the pixmaps are, in PrepareComposite():
+ */
+static Bool
+xa_setup_composite(struct exa_state *exa, int op, PicturePtr pSrcPicture,
 		PicturePtr pMaskPicture, PicturePtr pDstPicture)
 {
-	// XXX
-	return FALSE;
+	struct xa_composite *comp = &exa->comp;
+
+	/* the xa ops match the render ops, as far as they go: */
+	if (op > PictOpAdd)
+		return FALSE;
+
+	memset(comp, 0, sizeof(*comp));
+	comp->op = op;
+
+	if (!xa_setup_picture(&exa->src, pSrcPicture))
+		return FALSE;
+	comp->src = &exa->src;
+
+	if (pMaskPicture) {
+		if (!xa_setup_picture(&exa->mask, pMaskPicture))
+			return FALSE;
+		comp->mask = &exa->mask;
+	}
+
+	if (!xa_setup_picture(&exa->dst, pDstPicture))
+		return FALSE;
+	comp->dst = &exa->dst;
+
+	return xa_composite_check_accelerated(comp) == XA_ERR_NONE;
 }
 
 /**
@@ -264,9 +378,8 @@ XACheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 		PicturePtr pDstPicture)
 {
 	MSM_LOCALS(pDstPicture->pDrawable);
-	return xa_setup_composite(&exa->comp, op, pSrcPicture,
-			pMaskPicture, pDstPicture) &&
-		(xa_composite_check_accelerated(&exa->comp) == XA_ERR_NONE);
+	return xa_setup_composite(exa, op, pSrcPicture,
+			pMaskPicture, pDstPicture);
 }
 
 /**
@@ -330,6 +443,20 @@ XAPrepareComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 		PicturePtr pDstPicture, PixmapPtr pSrc, PixmapPtr pMask, PixmapPtr pDst)
 {
 	MSM_LOCALS(pDst);
+
+	if (!pSrc)
+		return FALSE;
+
+	exa->src.srf = msm_get_pixmap_surf(pSrc);
+	exa->dst.srf = msm_get_pixmap_surf(pDst);
+	if (!(exa->src.srf && exa->dst.srf))
+		return FALSE;
+	if (pMask) {
+		exa->mask.srf = msm_get_pixmap_surf(pMask);
+		if (!exa->mask.srf)
+			return FALSE;
+	}
+
 	return xa_composite_prepare(exa->ctx, &exa->comp) == XA_ERR_NONE;
 }
 
@@ -645,3 +772,166 @@ MSMSetupExaXA(ScreenPtr pScreen)
 
 	return exaDriverInit(pScreen, pMsm->pExa);
 }
+
+/* the XA surface for a 2D pixmap's bo, in hybrid mode: */
+static struct xa_surface *
+hybrid_surf(MSMPtr pMsm, PixmapPtr pix)
+{
+	struct msm_pixmap_priv *priv = exaGetPixmapDriverPrivate(pix);
+	enum xa_surface_type type;
+	uint32_t name;
+
+	if (!priv || !priv->bo)
+		return NULL;
+
+	if (priv->surf)
+		return priv->surf;
+
+	/* XA opens the bo by name, and uses it from another pipe, so it
+	 * isn't only ours any more:
+	 */
+	if (fd_bo_get_name(priv->bo, &name))
+		return NULL;
+	priv->exported = TRUE;
+
+	type = (pix->drawable.bitsPerPixel > 8) ? xa_type_argb : xa_type_a;
+
+	priv->surf = xa_surface_from_handle(pMsm->hybrid->xa,
+			pix->drawable.width, pix->drawable.height,
+			pix->drawable.depth, type, xa_format_unknown,
+			XA_FLAG_SHARED | XA_FLAG_RENDER_TARGET,
+			name, exaGetPixmapPitch(pix));
+
+	return priv->surf;
+}
+
+/**
+ * Submit what XA has queued, and if wait is set, wait for the 3D pipe
+ * to go idle, which retires the current batch.
+ */
+void
+MSMHybridFlush(MSMPtr pMsm, Bool wait)
+{
+	struct msm_hybrid *hybrid = pMsm->hybrid;
+	struct xa_fence *fence;
+	uint64_t start = msm_time_us();
+
+	xa_context_flush(hybrid->exa.ctx);
+
+	if (!wait)
+		return;
+
+	fence = xa_fence_get(hybrid->exa.ctx);
+	if (fence) {
+		xa_fence_wait(fence, ~0ULL);
+		xa_fence_destroy(fence);
+	}
+	msm_stats_wait(pMsm, WAIT_HYBRID, start);
+
+	hybrid->serial++;
+}
+
+/**
+ * Wait for XA rendering which the 2D pipe or the cpu is about to depend
+ * on: rendering to the pixmap, or from it too if it is going to be
+ * written.
+ */
+void
+MSMHybridWait(MSMPtr pMsm, struct msm_pixmap_priv *priv, Bool write)
+{
+	uint32_t serial = write ? priv->xa_serial : priv->xa_write_serial;
+
+	if (serial == pMsm->hybrid->serial)
+		MSMHybridFlush(pMsm, TRUE);
+}
+
+Bool
+MSMHybridCheckComposite(int op, PicturePtr pSrcPicture,
+		PicturePtr pMaskPicture, PicturePtr pDstPicture)
+{
+	HYBRID_LOCALS(pDstPicture->pDrawable);
+	return xa_setup_composite(exa, op, pSrcPicture,
+			pMaskPicture, pDstPicture);
+}
+
+Bool
+MSMHybridPrepareComposite(int op, PicturePtr pSrcPicture,
+		PicturePtr pMaskPicture, PicturePtr pDstPicture,
+		PixmapPtr pSrc, PixmapPtr pMask, PixmapPtr pDst)
+{
+	HYBRID_LOCALS(pDst);
+
+	if (!pSrc)
+		return FALSE;
+
+	exa->src.srf = hybrid_surf(pMsm, pSrc);
+	exa->dst.srf = hybrid_surf(pMsm, pDst);
+	if (!(exa->src.srf && exa->dst.srf))
+		return FALSE;
+	hybrid->src = exaGetPixmapDriverPrivate(pSrc);
+	hybrid->dst = exaGetPixmapDriverPrivate(pDst);
+	hybrid->mask = NULL;
+	if (pMask) {
+		exa->mask.srf = hybrid_surf(pMsm, pMask);
+		if (!exa->mask.srf)
+			return FALSE;
+		hybrid->mask = exaGetPixmapDriverPrivate(pMask);
+	}
+
+	/* the 2D submits which wrote what we read, or used what we
+	 * write, have to complete first:
+	 */
+	msm_serial_wait(pMsm, hybrid->dst->serial, WAIT_HYBRID);
+	msm_serial_wait(pMsm, hybrid->src->write_serial, WAIT_HYBRID);
+	if (hybrid->mask)
+		msm_serial_wait(pMsm, hybrid->mask->write_serial, WAIT_HYBRID);
+
+	return xa_composite_prepare(exa->ctx, &exa->comp) == XA_ERR_NONE;
+}
+
+void
+MSMHybridComposite(PixmapPtr pDst, int srcX, int srcY,
+		int maskX, int maskY, int dstX, int dstY, int width, int height)
+{
+	HYBRID_LOCALS(pDst);
+	xa_composite_rect(exa->ctx, srcX, srcY, maskX, maskY,
+			dstX, dstY, width, height);
+}
+
+void
+MSMHybridDoneComposite(PixmapPtr pDst)
+{
+	HYBRID_LOCALS(pDst);
+
+	xa_composite_done(exa->ctx);
+
+	hybrid->dst->xa_serial = hybrid->dst->xa_write_serial = hybrid->serial;
+	hybrid->src->xa_serial = hybrid->serial;
+	if (hybrid->mask)
+		hybrid->mask->xa_serial = hybrid->serial;
+}
+
+Bool
+MSMSetupHybridXA(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	MSMPtr pMsm = MSMPTR(pScrn);
+	struct msm_hybrid *hybrid;
+
+	hybrid = calloc(1, sizeof(*hybrid));
+	if (!hybrid)
+		return FALSE;
+
+	hybrid->xa = xa_tracker_create(pMsm->drmFD);
+	if (!hybrid->xa) {
+		free(hybrid);
+		return FALSE;
+	}
+
+	hybrid->exa.ctx = xa_context_default(hybrid->xa);
+	hybrid->serial = 1;
+
+	pMsm->hybrid = hybrid;
+
+	return TRUE;
+}
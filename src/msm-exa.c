@@ -37,9 +37,14 @@
 
 #include "msm.h"
 #include "msm-accel.h"
+#include "msm-blend.h"
 
 #include "freedreno_z1xx.h"
 
+#ifdef HAVE_XA
+#  include <xa_tracker.h>
+#endif
+
 #define xFixedtoDouble(_f) (double) ((_f)/(double) xFixed1)
 
 #define ENABLE_EXA_TRACE                0
@@ -65,16 +70,102 @@
         }                                                           \
     } while (0)
 
+/* REG()/REGM() as constant expressions, for the static templates: */
+#define TREG(reg)          ((uint32_t)(reg) << 24)
+#define TREGM(reg, count)  (TREG(VGV3_WRITERAW) | ((count) << 8) | (reg))
+
+/* the G2D_GRADIENT writes which follow each blit: */
+static const uint32_t blit_tail[] = {
+		TREG(G2D_GRADIENT),
+		TREG(G2D_GRADIENT),
+		TREG(G2D_GRADIENT),
+		TREG(G2D_GRADIENT),
+		TREG(G2D_GRADIENT),
+		TREG(G2D_GRADIENT),
+};
+
+/* magic, to enable repeat on the src: */
+static const uint32_t src_repeat[] = {
+		TREGM(GRADW_INST0, 2),
+		0x10080632,
+		0x12098695,
+		TREGM(GRADW_CONST0, 6),
+		0x00000000,
+		0x00400000,
+		0x0088fa80,
+		0x00400000,
+		0x00000000,
+		0x00890740,
+};
+
+/* per-pixmap values, worked out once in Prepare*() rather than per op: */
+struct exa_pix {
+	struct msm_pixmap_priv *priv;
+	struct fd_bo *bo;
+	uint32_t w, h;
+	/* pitch and format, the same bits for G2D_CFGn and GRADW_TEXCFG: */
+	uint32_t cfg;
+	uint32_t texsize;
+};
+
+/* a run of dwords built in Prepare*() for the variant of the op, which
+ * is emitted with a single copy and then the relocs patched in:
+ */
+struct exa_template {
+	uint32_t dwords[32];
+	int n;
+	struct {
+		int offset;
+		struct fd_bo *bo;
+	} relocs[2];
+	int nrelocs;
+};
+
 struct exa_state {
 	/* solid state: */
 	uint32_t fill;
 
+	/* solid/copy raster op, as ROP3: */
+	uint8_t rop3;
+
+	/* rects queued by Copy(), to be emitted together (see
+	 * flush_copy()):
+	 */
+	struct exa_rect {
+		int x, y, w, h;
+		int sx, sy;     /* copy only */
+	} rects[64];
+	int nrects;
+
 	/* copy/composite state: */
 	const uint32_t *op_dwords;
-	PixmapPtr src, mask;
 	PicturePtr dstpic, srcpic, maskpic;
+	struct exa_pix dst, src, mask;
+	Bool has_mask;
+
+	/* src/mask texture setup: */
+	struct exa_template tex;
+
+	/* composite state, for the variant set up by PrepareComposite(): */
+	Bool dst_noalpha, src_noalpha;
+	uint32_t fgbg, blend_a0, blend_c0, blendercfg, gradient;
+
+	/* the src/mask transforms, as whole pixel offsets, and whether the
+	 * blit must be clipped to where they are in bounds (see
+	 * translation()):
+	 */
+	int src_tx, src_ty, mask_tx, mask_ty;
+	Bool clip_src, clip_mask;
+
+	/* G2D_CONFIG for the op, solid and copy included: */
+	uint32_t config;
 
 	uint32_t input;
+
+	/* hybrid mode: the composite set up by CheckComposite() is one for
+	 * XA on the 3D pipe:
+	 */
+	Bool use_xa;
 };
 
 /* input fields seem to be enabled/disabled in a certain order: */
@@ -90,135 +181,260 @@ static uint32_t idis(struct exa_state *exa, uint32_t enable)
 	return exa->input;
 }
 
-/* NOTE ARGB and A8 seem to be treated the same when it comes to the
- * composite-op dwords:
+/* the G2D format of the pixmap, or -1 if there isn't one.  8bpp pixmaps
+ * are alpha-only, as that is what depth 8 is used for by render:
+ */
+static inline int
+pixfmt(PixmapPtr pix)
+{
+	switch (pix->drawable.bitsPerPixel) {
+	case 8:
+		return G2D_A8;
+	case 16:
+		return (pix->drawable.depth == 16) ? G2D_0565 : -1;
+	case 32:
+		return G2D_8888;
+	default:
+		return -1;
+	}
+}
+
+/* G2D_COLOR is a8r8g8b8 whatever the dst format, so expand the pixel
+ * value to that:
  */
-static const uint32_t composite_op_dwords[4][PictOpAdd+1][4] = {
-	{ /* xRGB->xRGB */         /*           G2D_BLEND_A0            G2D_BLEND_C0 */
-		[PictOpSrc]          = { 0x7c000114, 0x10002010, 0x00000000, 0x18012210 },
-		[PictOpIn]           = { 0x7c000114, 0xb0100004, 0x00000000, 0x18110a04 },
-		[PictOpOut]          = { 0x7c000114, 0xb0102004, 0x00000000, 0x18112a04 },
-		[PictOpOver]         = { 0x7c000114, 0xd080a004, 0x7c000118, 0x8081aa04 },
-		[PictOpOutReverse]   = { 0x7c000114, 0x80808040, 0x7c000118, 0x80808840 },
-		[PictOpAdd]          = { 0x7c000114, 0x5080a004, 0x7c000118, 0x20818204 },
-		[PictOpOverReverse]  = { 0x7c000114, 0x7090a004, 0x7c000118, 0x2091a204 },
-		[PictOpInReverse]    = { 0x7c000114, 0x80800040, 0x7c000118, 0x80800840 },
-		[PictOpAtop]         = { 0x7c000114, 0xf0908004, 0x7c000118, 0xa0918a04 },
-		[PictOpAtopReverse]  = { 0x7c000114, 0xf0902004, 0x7c000118, 0xa0912a04 },
-		[PictOpXor]          = { 0x7c000114, 0xf090a004, 0x7c000118, 0xa091aa04 },
-	},
-	{ /* xRGB->ARGB, xRGB->A8 */
-		[PictOpSrc]          = { 0x7c000114, 0x10002010, 0x00000000, 0x18012210 },
-		[PictOpIn]           = { 0x7c000114, 0x90100004, 0x00000000, 0x18110a04 },
-		[PictOpOut]          = { 0x7c000114, 0x90102004, 0x00000000, 0x18112a04 },
-		[PictOpOver]         = { 0x7c000114, 0x9080a004, 0x7c000118, 0x8081aa04 },
-		[PictOpOutReverse]   = { 0x7c000114, 0x80808040, 0x7c000118, 0x80808840 },
-		[PictOpAdd]          = { 0x7c000114, 0x1080a004, 0x7c000118, 0x20818204 },
-		[PictOpOverReverse]  = { 0x7c000114, 0x1090a004, 0x00000000, 0x1891a204 },
-		[PictOpInReverse]    = { 0x7c000114, 0x80800040, 0x7c000118, 0x80800840 },
-		[PictOpAtop]         = { 0x7c000114, 0x90908004, 0x7c000118, 0x80918a04 },
-		[PictOpAtopReverse]  = { 0x7c000114, 0x90902004, 0x7c000118, 0x80912a04 },
-		[PictOpXor]          = { 0x7c000114, 0x9090a004, 0x7c000118, 0x8091aa04 },
-	},
-	{ /* ARGB->xRGB, A8->xRGB */
-		[PictOpSrc]          = { 0x00000000, 0x14012010, 0x00000000, 0x18012210 },
-		[PictOpIn]           = { 0x7c000114, 0x20110004, 0x00000000, 0x18110a04 },
-		[PictOpOut]          = { 0x7c000114, 0x20112004, 0x00000000, 0x18112a04 },
-		[PictOpOver]         = { 0x7c000114, 0x4281a004, 0x7c000118, 0x0281aa04 },
-		[PictOpOutReverse]   = { 0x7c000114, 0x02808040, 0x7c000118, 0x02808840 },
-		[PictOpAdd]          = { 0x7c000114, 0x4081a004, 0x00000000, 0x18898204 },
-		[PictOpOverReverse]  = { 0x7c000114, 0x6091a004, 0x7c000118, 0x2091a204 },
-		[PictOpInReverse]    = { 0x7c000114, 0x02800040, 0x7c000118, 0x02800840 },
-		[PictOpAtop]         = { 0x7c000114, 0x62918004, 0x7c000118, 0x22918a04 },
-		[PictOpAtopReverse]  = { 0x7c000114, 0x62912004, 0x7c000118, 0x22912a04 },
-		[PictOpXor]          = { 0x7c000114, 0x6291a004, 0x7c000118, 0x2291aa04 },
-	},
-	{ /* ARGB->ARGB, A8->A8 */
-		[PictOpSrc]          = { 0x00000000, 0x14012010, 0x00000000, 0x18012210 },
-		[PictOpIn]           = { 0x00000000, 0x14110004, 0x00000000, 0x18110a04 },
-		[PictOpOut]          = { 0x00000000, 0x14112004, 0x00000000, 0x18112a04 },
-		[PictOpOver]         = { 0x7c000114, 0x0281a004, 0x7c000118, 0x0281aa04 },
-		[PictOpOutReverse]   = { 0x7c000114, 0x02808040, 0x7c000118, 0x02808840 },
-		[PictOpAdd]          = { 0x00000000, 0x1481a004, 0x00000000, 0x18898204 },
-		[PictOpOverReverse]  = { 0x00000000, 0x1491a004, 0x00000000, 0x1891a204 },
-		[PictOpInReverse]    = { 0x7c000114, 0x02800040, 0x7c000118, 0x02800840 },
-		[PictOpAtop]         = { 0x7c000114, 0x02918004, 0x7c000118, 0x02918a04 },
-		[PictOpAtopReverse]  = { 0x7c000114, 0x02912004, 0x7c000118, 0x02912a04 },
-		[PictOpXor]          = { 0x7c000114, 0x0291a004, 0x7c000118, 0x0291aa04 },
-	},
+static uint32_t
+solid_color(PixmapPtr pix, Pixel fg)
+{
+	switch (pixfmt(pix)) {
+	case G2D_A8:
+		return fg << 24;
+	case G2D_0565:
+		return ((fg << 3) & 0xf8)     | ((fg >> 2) & 0x07) |
+				((fg << 5) & 0xfc00)   | ((fg >> 1) & 0x300) |
+				((fg << 8) & 0xf80000) | ((fg << 3) & 0x70000) |
+				0xff000000; // implicitly DISABLE_ALPHA
+	default:
+		return fg;
+	}
+}
+
+/* the GX* alu codes as ROP3, S being the src (or the fill color): */
+static const uint8_t gx_rop3[16] = {
+		[GXclear]        = 0x00,
+		[GXand]          = 0x88,
+		[GXandReverse]   = 0x44,
+		[GXcopy]         = 0xcc,
+		[GXandInverted]  = 0x22,
+		[GXnoop]         = 0xaa,
+		[GXxor]          = 0x66,
+		[GXor]           = 0xee,
+		[GXnor]          = 0x11,
+		[GXequiv]        = 0x99,
+		[GXinvert]       = 0x55,
+		[GXorReverse]    = 0xdd,
+		[GXcopyInverted] = 0x33,
+		[GXorInverted]   = 0xbb,
+		[GXnand]         = 0x77,
+		[GXset]          = 0xff,
 };
 
-static inline enum g2d_format
-pixfmt(PixmapPtr pix)
+/* does the ROP3 depend on the dst, ie. need G2D_CONFIG_DST? */
+static inline Bool
+rop_reads_dst(uint8_t rop3)
 {
-	return (pix->drawable.depth == 8) ? G2D_A8 : G2D_8888;
+	return ((rop3 >> 1) & 0x55) != (rop3 & 0x55);
 }
 
-/* 15 dwords */
+/* G2D_ROP is only written for alus other than GXcopy, which works with
+ * whatever it was left at.  Put back the 0x0404 the context sets up
+ * after the blits, as nothing else writes it until the next submit:
+ */
 static inline void
-out_dstpix(struct fd_ringbuffer *ring, PixmapPtr pix)
+end_rop3(MSMPtr pMsm, struct exa_state *exa)
 {
-	struct fd_bo *bo = msm_get_pixmap_bo(pix);
-	uint32_t w, h, p;
+	if (exa->rop3 != gx_rop3[GXcopy])
+		OUT_RING  (pMsm->ring.ring, REG(G2D_ROP) | 0x0404);
+}
 
-	w = pix->drawable.width;
-	h = pix->drawable.height;
+/* the G2D_CONFIG_ARGBMASK() for the planemask, or -1 if the planemask
+ * doesn't cover whole channels.  Planes above the depth (the x of
+ * x8r8g8b8) don't matter either way:
+ */
+static int
+argbmask(PixmapPtr pix, Pixel planemask)
+{
+	static const uint32_t channels[][4] = {   /* a, r, g, b */
+			[G2D_A8]   = { 0xff, 0, 0, 0 },
+			[G2D_0565] = { 0, 0xf800, 0x07e0, 0x001f },
+			[G2D_8888] = { 0xff000000, 0xff0000, 0xff00, 0xff },
+	};
+	const uint32_t *c = channels[pixfmt(pix)];
+	uint32_t depthmask = (pix->drawable.depth >= 32) ? ~0 :
+			((1 << pix->drawable.depth) - 1);
+	int i, mask = 0;
+
+	for (i = 0; i < 4; i++) {
+		uint32_t m = c[i] & depthmask;
+
+		if ((planemask & m) == m)
+			continue;
+		if (planemask & m)
+			return -1;
+		mask |= 0x8 >> i;
+	}
+
+	return mask;
+}
+
+/* in hybrid mode, the bo may also be in use by XA on the 3D pipe: */
+static inline void
+hybrid_wait(MSMPtr pMsm, struct msm_pixmap_priv *priv, Bool write)
+{
+#ifdef HAVE_XA
+	if (pMsm->hybrid)
+		MSMHybridWait(pMsm, priv, write);
+#endif
+}
+
+static void
+prep_pix(MSMPtr pMsm, struct exa_pix *p, PixmapPtr pix, Bool write)
+{
+	p->priv = exaGetPixmapDriverPrivate(pix);
+	hybrid_wait(pMsm, p->priv, write);
+	p->bo = msm_get_pixmap_bo(pix);
+	p->w = pix->drawable.width;
+	p->h = pix->drawable.height;
 
 	/* pitch specified in units of 32 bytes, it appears.. not quite sure
 	 * max size yet, but I think 11 or 12 bits..
 	 */
-	p = (exaGetPixmapPitch(pix) / 32) & 0xfff;
-
-	TRACE_EXA("DST: %p, %dx%d,%d,%d", bo, w, h, p, pix->drawable.depth);
-
-	OUT_RING (ring, REG(G2D_ALPHABLEND) | 0x0);
-	OUT_RING (ring, REG(G2D_BLENDERCFG) | 0x0);
-	OUT_RING (ring, REG(G2D_GRADIENT) | 0x030000);
-	OUT_RING (ring, GRADW_TEXSIZE_WIDTH(w) | /* GRADW_TEXSIZE */
-			GRADW_TEXSIZE_HEIGHT(h));
-	OUT_RING (ring, REG(G2D_CFG0) |
-			G2D_CFGn_PITCH(p) |
-			G2D_CFGn_FORMAT(pixfmt(pix)));
-	OUT_RING (ring, REGM(G2D_BASE0, 1));
-	OUT_RELOC(ring, bo, TRUE);
-	OUT_RING (ring, REGM(GRADW_TEXBASE, 1));
-	OUT_RELOC(ring, bo, TRUE);
-	OUT_RING (ring, REGM(GRADW_TEXCFG, 1));
-	OUT_RING (ring, 0x40000000 |
-			GRADW_TEXCFG_PITCH(p) |
-			GRADW_TEXCFG_FORMAT(pixfmt(pix)));
-	OUT_RING (ring, REG(GRADW_TEXCFG2) | 0x0);
-	OUT_RING (ring, REG(G2D_ALPHABLEND) | 0x0);
-	OUT_RING (ring, REG(G2D_SCISSORX) | (w & 0xfff) << 12);
-	OUT_RING (ring, REG(G2D_SCISSORY) | (h & 0xfff) << 12);
+	p->cfg = G2D_CFGn_PITCH(exaGetPixmapPitch(pix) / 32) |
+			G2D_CFGn_FORMAT(pixfmt(pix));
+	p->texsize = GRADW_TEXSIZE_WIDTH(p->w) | GRADW_TEXSIZE_HEIGHT(p->h);
+}
+
+/* record the pixmap as used by the latest submit with rendering in it,
+ * for MSMPrepareAccess().  Called from the Done*() hooks, so it covers
+ * all the ops since Prepare*(), even if the ringbuffer filled up and
+ * was submitted part way through:
+ */
+static void
+done_pix(MSMPtr pMsm, const struct exa_pix *pix, Bool write)
+{
+	uint32_t serial = last_serial(pMsm);
+
+	pix->priv->serial = serial;
+	if (write)
+		pix->priv->write_serial = serial;
+}
+
+static void
+tmpl_dwords(struct exa_template *t, const uint32_t *dwords, int n)
+{
+	memcpy(&t->dwords[t->n], dwords, n * sizeof(uint32_t));
+	t->n += n;
+}
+
+static void
+tmpl_dword(struct exa_template *t, uint32_t dword)
+{
+	t->dwords[t->n++] = dword;
+}
+
+static void
+tmpl_reloc(struct exa_template *t, struct fd_bo *bo)
+{
+	t->relocs[t->nrelocs].offset = t->n;
+	t->relocs[t->nrelocs].bo = bo;
+	t->nrelocs++;
+	tmpl_dword(t, 0x00000000);
 }
 
 /* 4 dwords */
+static void
+tmpl_srcpix(struct exa_template *t, const struct exa_pix *pix)
+{
+	TRACE_EXA("SRC: %p, %dx%d,%08x", pix->bo, pix->w, pix->h, pix->cfg);
+
+	tmpl_dword(t, TREGM(GRADW_TEXCFG, 3));
+	tmpl_dword(t, pix->cfg);                /* GRADW_TEXCFG */
+	tmpl_dword(t, pix->texsize);            /* GRADW_TEXSIZE */
+	tmpl_reloc(t, pix->bo);                 /* GRADW_TEXBASE */
+}
+
 static inline void
-out_srcpix(struct fd_ringbuffer *ring, PixmapPtr pix)
+out_template(MSMPtr pMsm, const struct exa_template *t)
 {
-	struct fd_bo *bo = msm_get_pixmap_bo(pix);
-	uint32_t w, h, p;
-	uint32_t texcfg;
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+	uint32_t *start = ring->cur;
+	int i;
+
+	OUT_RINGS(ring, t->dwords, t->n);
+	for (i = 0; i < t->nrelocs; i++)
+		OUT_BO_AT(pMsm, &start[t->relocs[i].offset],
+				t->relocs[i].bo, FALSE);
+}
 
-	w = pix->drawable.width;
-	h = pix->drawable.height;
+/* up to 15 dwords */
+static inline void
+out_dstpix(MSMPtr pMsm, const struct exa_pix *pix)
+{
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+	uint32_t texcfg = 0x40000000 | pix->cfg;
 
-	/* pitch specified in units of 32 bytes, it appears.. not quite sure
-	 * max size yet, but I think 11 or 12 bits..
-	 */
-	p = (exaGetPixmapPitch(pix) / 32) & 0xfff;
+	TRACE_EXA("DST: %p, %dx%d,%08x", pix->bo, pix->w, pix->h, pix->cfg);
+
+	ring_dst(pMsm, pix->bo);
 
-	TRACE_EXA("SRC: %p, %dx%d,%d,%d", bo, w, h, p, pix->drawable.depth);
+	OUT_REG  (pMsm, G2D_ALPHABLEND, 0x0);
+	OUT_REG  (pMsm, G2D_BLENDERCFG, 0x0);
 
-	texcfg = GRADW_TEXCFG_PITCH(p) |
-			GRADW_TEXCFG_FORMAT(pixfmt(pix));
+	/* the dst texture state is only written here, so if it is the same
+	 * dst as last time we can skip it entirely:
+	 */
+	if ((pMsm->ring.shadow.dst != pix->bo) ||
+			(pMsm->ring.shadow.dst_texsize != pix->texsize) ||
+			(pMsm->ring.shadow.dst_texcfg != texcfg)) {
+		OUT_RING (ring, REG(G2D_GRADIENT) | 0x030000);
+		OUT_RING (ring, pix->texsize);  /* GRADW_TEXSIZE */
+		/* which also decodes as a write to G2D_BASE0 (or G2D_CFG0 for
+		 * 2048 pixel high pixmaps), so forget what we had there:
+		 */
+		shadow_invalidate(pMsm, G2D_BASE0);
+		shadow_invalidate(pMsm, G2D_CFG0);
+		OUT_REG  (pMsm, G2D_CFG0, pix->cfg);
+		OUT_RING (ring, REGM(G2D_BASE0, 1));
+		OUT_BO   (pMsm, pix->bo, TRUE);
+		OUT_RING (ring, REGM(GRADW_TEXBASE, 1));
+		OUT_BO   (pMsm, pix->bo, TRUE);
+		OUT_RING (ring, REGM(GRADW_TEXCFG, 1));
+		OUT_RING (ring, texcfg);
+		OUT_RING (ring, REG(GRADW_TEXCFG2) | 0x0);
+
+		pMsm->ring.shadow.dst = pix->bo;
+		pMsm->ring.shadow.dst_texsize = pix->texsize;
+		pMsm->ring.shadow.dst_texcfg = texcfg;
+	} else {
+		OUT_REG  (pMsm, G2D_CFG0, pix->cfg);
+	}
 
-	OUT_RING (ring, REGM(GRADW_TEXCFG, 3));
-	OUT_RING (ring, texcfg);                /* GRADW_TEXCFG */
-	OUT_RING (ring, GRADW_TEXSIZE_WIDTH(w) |/* GRADW_TEXSIZE */
-			GRADW_TEXSIZE_HEIGHT(h));
-	OUT_RELOC(ring, bo, FALSE);             /* GRADW_TEXBASE */
+	OUT_REG  (pMsm, G2D_SCISSORX, (pix->w & 0xfff) << 12);
+	OUT_REG  (pMsm, G2D_SCISSORY, (pix->h & 0xfff) << 12);
+}
+
+/* up to 3 dwords */
+static inline void
+out_fgbg(MSMPtr pMsm, uint32_t color)
+{
+	struct fd_ringbuffer *ring = pMsm->ring.ring;
+
+	/* note: bitwise-or, we want both shadow values updated: */
+	if (shadow_update(pMsm, G2D_FOREGROUND, color) |
+			shadow_update(pMsm, G2D_BACKGROUND, color)) {
+		OUT_RING (ring, REGM(G2D_FOREGROUND, 2));
+		OUT_RING (ring, color);            /* G2D_FOREGROUND */
+		OUT_RING (ring, color);            /* G2D_BACKGROUND */
+	}
 }
 
 /**
@@ -246,23 +462,27 @@ static Bool
 MSMPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fg)
 {
 	MSM_LOCALS(pPixmap);
+	int mask;
 
-	EXA_FAIL_IF(planemask != FB_ALLONES);
-	EXA_FAIL_IF(alu != GXcopy);
-
-	// TODO other color formats
-	EXA_FAIL_IF(pPixmap->drawable.bitsPerPixel != 32);
-
-	exa->fill = fg;
-
-	/* Note: 16bpp 565 we want something like this.. I think..
-
-		color  = ((fg << 3) & 0xf8) | ((fg >> 2) & 0x07) |
-			((fg << 5) & 0xfc00)    | ((fg >> 1) & 0x300) |
-			((fg << 8) & 0xf80000)  | ((fg << 3) & 0x70000) |
-			0xff000000; // implicitly DISABLE_ALPHA
+	EXA_FAIL_IF(pixfmt(pPixmap) < 0);
+	mask = argbmask(pPixmap, planemask);
+	EXA_FAIL_IF(mask < 0);
 
+	/* GXclear's ROP3 of 0 is what G2D_ROP is left at anyways, see
+	 * G2D_ROP_ROP3(), so fill with 0 instead:
 	 */
+	if (alu == GXclear) {
+		alu = GXcopy;
+		fg = 0;
+	}
+	/* the G2D_ROP encoding is a guess, so other alus are opt-in: */
+	EXA_FAIL_IF((alu != GXcopy) && !pMsm->RasterOps);
+
+	exa->fill = solid_color(pPixmap, fg);
+	exa->rop3 = gx_rop3[alu & 0xf];
+	exa->config = G2D_CONFIG_ARGBMASK(mask) |
+			((mask || rop_reads_dst(exa->rop3)) ? G2D_CONFIG_DST : 0);
+	prep_pix(pMsm, &exa->dst, pPixmap, TRUE);
 
 	return TRUE;
 }
@@ -294,20 +514,23 @@ MSMSolid(PixmapPtr pPixmap, int x1, int y1, int x2, int y2)
 	TRACE_EXA("SOLID: x1=%d\ty1=%d\tx2=%d\ty2=%d\tfill=%08x",
 			x1, y1, x2, y2, exa->fill);
 
-	BEGIN_RING(pMsm, 25);
+	BEGIN_RING(pMsm, 29);
 	ring = pMsm->ring.ring;
-	out_dstpix(ring, pPixmap);
+	out_dstpix(pMsm, &exa->dst);
 	OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_SCOORD1));
 	OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_SCOORD2));
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0x0));
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, G2D_INPUT_COLOR));
-	OUT_RING  (ring, REG(G2D_CONFIG) | 0x0);
+	if (exa->rop3 != gx_rop3[GXcopy])
+		OUT_RING  (ring, REG(G2D_ROP) | G2D_ROP_ROP3(exa->rop3));
+	OUT_REG   (pMsm, G2D_CONFIG, exa->config);
 	OUT_RING  (ring, REGM(G2D_XY, 2));
 	OUT_RING  (ring, G2D_XY_X(x1) | G2D_XY_Y(y1));    /* G2D_XY */
 	OUT_RING  (ring, G2D_WIDTHHEIGHT_WIDTH(x2-x1) |   /* G2D_WIDTHHEIGHT */
 			G2D_WIDTHHEIGHT_HEIGHT(y2-y1));
 	OUT_RING  (ring, REGM(G2D_COLOR, 1));
 	OUT_RING  (ring, exa->fill);
+	end_rop3(pMsm, exa);
 	END_RING  (pMsm);
 }
 
@@ -326,7 +549,113 @@ MSMSolid(PixmapPtr pPixmap, int x1, int y1, int x2, int y2)
 static void
 MSMDoneSolid(PixmapPtr pPixmap)
 {
+	MSM_LOCALS(pPixmap);
+	done_pix(pMsm, &exa->dst, TRUE);
+}
+
+/* does the copy read from where it writes?  Then it would see its own
+ * output, in whatever order the blit walks the pixels.  Not if it is
+ * onto itself, each pixel then only reads itself:
+ */
+static inline Bool
+copy_overlaps(struct exa_state *exa, const struct exa_rect *r)
+{
+	return (exa->src.bo == exa->dst.bo) &&
+			((r->x != r->sx) || (r->y != r->sy)) &&
+			(r->sx < (r->x + r->w)) && (r->x < (r->sx + r->w)) &&
+			(r->sy < (r->y + r->h)) && (r->y < (r->sy + r->h));
+}
+
+/* scrolling and window moves come as runs of boxes which touch, with
+ * the same src to dst offset, so grow the last queued rect over the new
+ * one if together they are still a rect.  Unless the merged copy would
+ * overlap itself, then it isn't the same as the two copies in order:
+ */
+static Bool
+merge_rect(struct exa_state *exa, struct exa_rect *last,
+		const struct exa_rect *r)
+{
+	struct exa_rect m;
+
+	if (((r->sx - r->x) != (last->sx - last->x)) ||
+			((r->sy - r->y) != (last->sy - last->y)))
+		return FALSE;
+
+	if ((r->y == last->y) && (r->h == last->h) &&
+			((r->x == (last->x + last->w)) || ((r->x + r->w) == last->x))) {
+		m = (r->x < last->x) ? *r : *last;
+		m.w = last->w + r->w;
+	} else if ((r->x == last->x) && (r->w == last->w) &&
+			((r->y == (last->y + last->h)) || ((r->y + r->h) == last->y))) {
+		m = (r->y < last->y) ? *r : *last;
+		m.h = last->h + r->h;
+	} else {
+		return FALSE;
+	}
+
+	if (copy_overlaps(exa, &m))
+		return FALSE;
+
+	*last = m;
+
+	return TRUE;
+}
+
+/* emit the queued copies: the state once, and then just the
+ * coordinates of each rect:
+ */
+static void
+flush_copy(MSMPtr pMsm, struct exa_state *exa)
+{
+	struct fd_ringbuffer *ring;
+	int i;
+
+	if (!exa->nrects)
+		return;
+
+	BEGIN_RING(pMsm, 41 + 10 * exa->nrects);
+	ring = pMsm->ring.ring;
+	out_dstpix(pMsm, &exa->dst);
+	out_fgbg  (pMsm, 0xff000000);
+	OUT_REG   (pMsm, G2D_BLENDERCFG, 0x0);
+	out_template(pMsm, &exa->tex);
+	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, G2D_INPUT_SCOORD1));
+	OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_SCOORD2));
+	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
+	OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_COLOR));
+	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, G2D_INPUT_COPYCOORD));
+	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
+	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
+	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
+	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
+	if (exa->rop3 != gx_rop3[GXcopy])
+		OUT_RING  (ring, REG(G2D_ROP) | G2D_ROP_ROP3(exa->rop3));
+	OUT_REG   (pMsm, G2D_CONFIG, exa->config);
+	for (i = 0; i < exa->nrects; i++) {
+		const struct exa_rect *r = &exa->rects[i];
+		OUT_RING  (ring, REGM(G2D_XY, 3));
+		OUT_RING  (ring, G2D_XY_X(r->x) | G2D_XY_Y(r->y)); /* G2D_XY */
+		OUT_RING  (ring, G2D_WIDTHHEIGHT_WIDTH(r->w) | /* G2D_WIDTHHEIGHT */
+				G2D_WIDTHHEIGHT_HEIGHT(r->h));
+		OUT_RING  (ring, G2D_SXYn_X(r->sx) |           /* G2D_SXY */
+				G2D_SXYn_Y(r->sy));
+		OUT_RINGS (ring, blit_tail, ARRAY_SIZE(blit_tail));
+	}
+	end_rop3(pMsm, exa);
+	END_RING  (pMsm);
 
+	exa->nrects = 0;
+}
+
+/* 7 dwords */
+static void
+tmpl_copy(struct exa_template *t, const struct exa_pix *src)
+{
+	t->n = t->nrelocs = 0;
+	tmpl_dword (t, TREG(G2D_GRADIENT) | 0x0);
+	tmpl_srcpix(t, src);
+	tmpl_dword (t, TREG(GRADW_TEXCFG2) | 0x0);
+	tmpl_dword (t, TREG(G2D_GRADIENT) | 0x0);
 }
 
 /**
@@ -365,19 +694,177 @@ MSMPrepareCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int dx, int dy,
 		int alu, Pixel planemask)
 {
 	MSM_LOCALS(pDstPixmap);
+	int mask;
+
+	/* the src is converted to the dst format, but only the same
+	 * bpp has been tried:
+	 */
+	EXA_FAIL_IF(pixfmt(pDstPixmap) < 0);
+	EXA_FAIL_IF(pixfmt(pSrcPixmap) < 0);
+	EXA_FAIL_IF(pSrcPixmap->drawable.bitsPerPixel !=
+			pDstPixmap->drawable.bitsPerPixel);
+	/* GXclear's ROP3 of 0 can't be written, see G2D_ROP_ROP3(), and
+	 * other alus than GXcopy are opt-in, as for solid fills:
+	 */
+	EXA_FAIL_IF(alu == GXclear);
+	EXA_FAIL_IF((alu != GXcopy) && !pMsm->RasterOps);
+	mask = argbmask(pDstPixmap, planemask);
+	EXA_FAIL_IF(mask < 0);
+
+	exa->rop3 = gx_rop3[alu & 0xf];
+	exa->config = G2D_CONFIG_SRC1 | G2D_CONFIG_ARGBMASK(mask) |
+			((mask || rop_reads_dst(exa->rop3)) ? G2D_CONFIG_DST : 0);
+	exa->nrects = 0;
+	prep_pix(pMsm, &exa->dst, pDstPixmap, TRUE);
+	prep_pix(pMsm, &exa->src, pSrcPixmap, FALSE);
+	tmpl_copy(&exa->tex, &exa->src);
+
+	return TRUE;
+}
+
+static void
+queue_copy(MSMPtr pMsm, struct exa_state *exa, const struct exa_rect *r)
+{
+	if (exa->nrects == ARRAY_SIZE(exa->rects))
+		flush_copy(pMsm, exa);
+
+	exa->rects[exa->nrects++] = *r;
+}
+
+/* overlapping copies which move less than MIN_BAND rows and columns
+ * are bounced through a SCRATCH_W x SCRATCH_H scratch bo a chunk at a
+ * time, rather than split into a blit per row (or column) or so:
+ */
+#define MIN_BAND    16
+#define SCRATCH_W   512
+#define SCRATCH_H   128
 
-	EXA_FAIL_IF(planemask != FB_ALLONES);
-	EXA_FAIL_IF(alu != GXcopy);
+/* emit a copy of r right away, from src to dst, with the state of the
+ * copy set up by PrepareCopy() or else as a plain copy:
+ */
+static void
+bounce_leg(MSMPtr pMsm, struct exa_state *exa, const struct exa_pix *dst,
+		const struct exa_pix *src, Bool plain, const struct exa_rect *r)
+{
+	uint32_t config = exa->config;
+	uint8_t rop3 = exa->rop3;
+
+	exa->dst = *dst;
+	exa->src = *src;
+	tmpl_copy(&exa->tex, src);
+	if (plain) {
+		exa->config = G2D_CONFIG_SRC1;
+		exa->rop3 = gx_rop3[GXcopy];
+	}
+
+	queue_copy(pMsm, exa, r);
+	flush_copy(pMsm, exa);
+
+	exa->config = config;
+	exa->rop3 = rop3;
+}
+
+/* copy each chunk of r into the scratch bo and from there to where it
+ * goes.  The chunks go starting from the side the copy moves towards,
+ * in both directions, so none reads what an earlier one wrote:
+ */
+static Bool
+bounce_copy(MSMPtr pMsm, struct exa_state *exa, const struct exa_rect *r)
+{
+	struct exa_pix dst = exa->dst, src = exa->src, scratch;
+	int dx = r->x - r->sx, dy = r->y - r->sy;
+	int i, j;
 
-	// TODO other color formats
-	EXA_FAIL_IF(pSrcPixmap->drawable.bitsPerPixel != 32);
-	EXA_FAIL_IF(pDstPixmap->drawable.bitsPerPixel != 32);
+	if (!pMsm->ring.scratch)
+		pMsm->ring.scratch = fd_bo_new(pMsm->dev,
+				SCRATCH_W * SCRATCH_H * 4,
+				DRM_FREEDRENO_GEM_TYPE_KMEM);
+	if (!pMsm->ring.scratch)
+		return FALSE;
+
+	/* in the src format, with a pitch which fits any of them: */
+	scratch.priv = NULL;
+	scratch.bo = pMsm->ring.scratch;
+	scratch.w = SCRATCH_W;
+	scratch.h = SCRATCH_H;
+	scratch.cfg = (src.cfg & ~G2D_CFGn_PITCH(~0)) |
+			G2D_CFGn_PITCH(SCRATCH_W * 4 / 32);
+	scratch.texsize = GRADW_TEXSIZE_WIDTH(SCRATCH_W) |
+			GRADW_TEXSIZE_HEIGHT(SCRATCH_H);
+
+	flush_copy(pMsm, exa);
+
+	for (j = 0; j < r->h; j += SCRATCH_H) {
+		for (i = 0; i < r->w; i += SCRATCH_W) {
+			struct exa_rect c = {
+				.w = min(SCRATCH_W, r->w - i),
+				.h = min(SCRATCH_H, r->h - j),
+			};
+			int ox = (dx > 0) ? max(r->w - i - SCRATCH_W, 0) : i;
+			int oy = (dy > 0) ? max(r->h - j - SCRATCH_H, 0) : j;
+
+			c.sx = r->sx + ox;
+			c.sy = r->sy + oy;
+			bounce_leg(pMsm, exa, &scratch, &src, TRUE, &c);
+
+			c.x = r->x + ox;
+			c.y = r->y + oy;
+			c.sx = c.sy = 0;
+			bounce_leg(pMsm, exa, &dst, &scratch, FALSE, &c);
+		}
+	}
 
-	exa->src = pSrcPixmap;
+	exa->src = src;
+	tmpl_copy(&exa->tex, &src);
 
 	return TRUE;
 }
 
+/* split a copy which overlaps itself into bands no taller (or narrower)
+ * than the distance it moves down (or across), whichever is further, so
+ * that no band overlaps itself.  They are queued starting from the side
+ * the copy moves towards, so no band reads what an earlier one wrote.
+ * This doesn't depend on dx/dy from PrepareCopy(), which is only a hint
+ * for hardware with a configurable blit direction:
+ */
+static void
+queue_bands(MSMPtr pMsm, struct exa_state *exa, const struct exa_rect *r)
+{
+	int dx = r->x - r->sx, dy = r->y - r->sy;
+	Bool rows = abs(dy) >= abs(dx);
+	int step = rows ? abs(dy) : abs(dx);
+	int size = rows ? r->h : r->w;
+	Bool reverse = rows ? (dy > 0) : (dx > 0);
+	int i;
+
+	/* not an overlap to begin with, see copy_overlaps(): */
+	if (!step) {
+		queue_copy(pMsm, exa, r);
+		return;
+	}
+
+	if ((step < MIN_BAND) && bounce_copy(pMsm, exa, r))
+		return;
+
+	for (i = 0; i < size; i += step) {
+		struct exa_rect b = *r;
+		int off = reverse ? max(size - i - step, 0) : i;
+		int len = min(step, size - i);
+
+		if (rows) {
+			b.y += off;
+			b.sy += off;
+			b.h = len;
+		} else {
+			b.x += off;
+			b.sx += off;
+			b.w = len;
+		}
+
+		queue_copy(pMsm, exa, &b);
+	}
+}
+
 /**
  * Copy() performs a copy set up in the last PrepareCopy call.
  *
@@ -407,45 +894,26 @@ MSMCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX, int dstY,
 		int width, int height)
 {
 	MSM_LOCALS(pDstPixmap);
-	PixmapPtr pSrcPixmap = exa->src;
+	struct exa_rect r = {
+		.x = dstX, .y = dstY, .w = width, .h = height,
+		.sx = srcX, .sy = srcY,
+	};
 
 	TRACE_EXA("COPY: srcX=%d\tsrcY=%d\tdstX=%d\tdstY=%d\twidth=%d\theight=%d",
 			srcX, srcY, dstX, dstY, width, height);
 
-	BEGIN_RING(pMsm, 46);
-	ring = pMsm->ring.ring;
-	out_dstpix(ring, pDstPixmap);
-	OUT_RING  (ring, REGM(G2D_FOREGROUND, 2));
-	OUT_RING  (ring, 0xff000000);      /* G2D_FOREGROUND */
-	OUT_RING  (ring, 0xff000000);      /* G2D_BACKGROUND */
-	OUT_RING  (ring, REG(G2D_BLENDERCFG) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	out_srcpix(ring, pSrcPixmap);
-	OUT_RING  (ring, REG(GRADW_TEXCFG2) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, G2D_INPUT_SCOORD1));
-	OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_SCOORD2));
-	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
-	OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_COLOR));
-	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, G2D_INPUT_COPYCOORD));
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
-	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
-	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
-	OUT_RING  (ring, REG(G2D_CONFIG) | G2D_CONFIG_SRC1); /* we don't read from dst */
-	OUT_RING  (ring, REGM(G2D_XY, 3));
-	OUT_RING  (ring, G2D_XY_X(dstX) | G2D_XY_Y(dstY));/* G2D_XY */
-	OUT_RING  (ring, G2D_WIDTHHEIGHT_WIDTH(width) |   /* G2D_WIDTHHEIGHT */
-			G2D_WIDTHHEIGHT_HEIGHT(height));
-	OUT_RING  (ring, G2D_SXYn_X(srcX) |               /* G2D_SXY */
-			G2D_SXYn_Y(srcY));
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	END_RING  (pMsm);
+	/* a plain copy onto itself doesn't change anything: */
+	if ((exa->src.bo == exa->dst.bo) && (srcX == dstX) && (srcY == dstY) &&
+			(exa->rop3 == gx_rop3[GXcopy]))
+		return;
+
+	if (exa->nrects && merge_rect(exa, &exa->rects[exa->nrects - 1], &r))
+		return;
+
+	if (copy_overlaps(exa, &r))
+		queue_bands(pMsm, exa, &r);
+	else
+		queue_copy(pMsm, exa, &r);
 }
 
 /**
@@ -463,7 +931,64 @@ MSMCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX, int dstY,
 static void
 MSMDoneCopy(PixmapPtr pDstPixmap)
 {
+	MSM_LOCALS(pDstPixmap);
+	flush_copy(pMsm, exa);
+	done_pix(pMsm, &exa->dst, TRUE);
+	done_pix(pMsm, &exa->src, FALSE);
+}
+
+/* only transforms which move the picture by whole pixels are handled,
+ * by adding the offset to the sample position.  Then nearest and
+ * bilinear filtering give the same result.  Scaling and rotation are
+ * left to the 3D pipe in hybrid mode, or else to software:
+ */
+static Bool
+translation(PicturePtr pict, int *tx, int *ty)
+{
+	PictTransformPtr t = pict->transform;
+
+	*tx = *ty = 0;
 
+	if ((pict->filter != PictFilterNearest) &&
+			(pict->filter != PictFilterBilinear))
+		return FALSE;
+
+	if (!t)
+		return TRUE;
+
+	if ((t->matrix[0][0] != xFixed1) || (t->matrix[0][1] != 0) ||
+			(t->matrix[1][0] != 0) || (t->matrix[1][1] != xFixed1) ||
+			(t->matrix[2][0] != 0) || (t->matrix[2][1] != 0) ||
+			(t->matrix[2][2] != xFixed1) ||
+			xFixedFrac(t->matrix[0][2]) || xFixedFrac(t->matrix[1][2]))
+		return FALSE;
+
+	*tx = xFixedToInt(t->matrix[0][2]);
+	*ty = xFixedToInt(t->matrix[1][2]);
+
+	return TRUE;
+}
+
+/* a transformed picture which doesn't repeat can be sampled outside of
+ * its pixmap, which the 2D core doesn't treat as transparent.  With ops
+ * where a transparent src leaves the dst as it is, that can be handled
+ * by clipping the blit to where the picture is in bounds:
+ */
+static inline Bool
+op_keeps_dst(int op)
+{
+	switch (op) {
+	case PictOpDst:
+	case PictOpOver:
+	case PictOpOverReverse:
+	case PictOpOutReverse:
+	case PictOpAtop:
+	case PictOpXor:
+	case PictOpAdd:
+		return TRUE;
+	default:
+		return FALSE;
+	}
 }
 
 /**
@@ -492,11 +1017,11 @@ MSMDoneCopy(PixmapPtr pDstPixmap)
  * implemented, but is not required.
  */
 static Bool
-MSMCheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
-		PicturePtr pDstPicture)
+check_composite(struct exa_state *exa, int op, PicturePtr pSrcPicture,
+		PicturePtr pMaskPicture, PicturePtr pDstPicture)
 {
-	MSM_LOCALS(pDstPicture->pDrawable);
-	int idx = 0;
+	int idx = 0, src_tx, src_ty, mask_tx = 0, mask_ty = 0;
+	Bool clip_src, clip_mask = FALSE;
 
 	// TODO proper handling for RGB vs BGR!
 
@@ -517,16 +1042,24 @@ MSMCheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 				(pMaskPicture->format != PICT_x8r8g8b8) &&
 				(pMaskPicture->format != PICT_x8b8g8r8) &&
 				(pMaskPicture->format != PICT_a8));
-		EXA_FAIL_IF(pMaskPicture->transform);
+		EXA_FAIL_IF(!translation(pMaskPicture, &mask_tx, &mask_ty));
 		/* this doesn't appear to be supported by libC2D2.. although
 		 * perhaps it is supported by the hw?  It might be worth
 		 * experimenting with this at some point
 		 */
 		EXA_FAIL_IF(pMaskPicture->componentAlpha);
+		// XXX for now only supporting repeat on src..
+		EXA_FAIL_IF(pMaskPicture->repeat);
+		clip_mask = !!pMaskPicture->transform;
+		EXA_FAIL_IF(clip_mask && !op_keeps_dst(op));
 	}
 
-	// TODO src add transforms later:
-	EXA_FAIL_IF(pSrcPicture->transform);
+	EXA_FAIL_IF(!translation(pSrcPicture, &src_tx, &src_ty));
+	/* the 2D core only tiles, it can't pad or reflect: */
+	EXA_FAIL_IF(pSrcPicture->repeat &&
+			(pSrcPicture->repeatType != RepeatNormal));
+	clip_src = pSrcPicture->transform && !pSrcPicture->repeat;
+	EXA_FAIL_IF(clip_src && !op_keeps_dst(op));
 
 	if (PICT_FORMAT_A(pSrcPicture->format))
 		idx += 2;
@@ -541,10 +1074,40 @@ MSMCheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 	exa->dstpic    = pDstPicture;
 	exa->srcpic    = pSrcPicture;
 	exa->maskpic   = pMaskPicture;
+	exa->src_tx    = src_tx;
+	exa->src_ty    = src_ty;
+	exa->mask_tx   = mask_tx;
+	exa->mask_ty   = mask_ty;
+	exa->clip_src  = clip_src;
+	exa->clip_mask = clip_mask;
 
 	return TRUE;
 }
 
+static Bool
+MSMCheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
+		PicturePtr pDstPicture)
+{
+	MSM_LOCALS(pDstPicture->pDrawable);
+
+	exa->use_xa = FALSE;
+	if (check_composite(exa, op, pSrcPicture, pMaskPicture, pDstPicture))
+		return TRUE;
+
+#ifdef HAVE_XA
+	/* transforms, component alpha and such, which the 2D core can't do,
+	 * may still be accelerated on the 3D pipe:
+	 */
+	if (pMsm->hybrid && MSMHybridCheckComposite(op, pSrcPicture,
+			pMaskPicture, pDstPicture)) {
+		exa->use_xa = TRUE;
+		return TRUE;
+	}
+#endif
+
+	return FALSE;
+}
+
 /**
  * PrepareComposite() sets up the driver for doing a Composite operation
  * described in the Render extension protocol spec.
@@ -607,19 +1170,81 @@ MSMPrepareComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 {
 	MSM_LOCALS(pDst);
 
+#ifdef HAVE_XA
+	if (exa->use_xa)
+		return MSMHybridPrepareComposite(op, pSrcPicture, pMaskPicture,
+				pDstPicture, pSrc, pMask, pDst);
+#endif
+
 	// TODO, maybe we can support this.. pSrcPicture could be telling
 	// us to do solid, which we could probably support
 	EXA_FAIL_IF(!pSrc);
 
-	// XXX for now only supporting it on src..
-	EXA_FAIL_IF(pMaskPicture && pMaskPicture->repeat);
+	exa->has_mask    = !!pMask;
+	exa->dst_noalpha = !PICT_FORMAT_A(pDstPicture->format);
+	exa->src_noalpha = !PICT_FORMAT_A(pSrcPicture->format);
+
+	prep_pix(pMsm, &exa->dst, pDst, TRUE);
+	prep_pix(pMsm, &exa->src, pSrc, FALSE);
+	if (pMask)
+		prep_pix(pMsm, &exa->mask, pMask, FALSE);
+
+	/* the op dwords are either REGM header + value, or (if the first
+	 * dword is zero) the value in REG form:
+	 */
+	exa->blend_a0 = exa->op_dwords[0] ?
+			exa->op_dwords[1] : (exa->op_dwords[1] & 0xffffff);
+	exa->blend_c0 = exa->op_dwords[2] ?
+			exa->op_dwords[3] : (exa->op_dwords[3] & 0xffffff);
 
-	exa->src  = pSrc;
-	exa->mask = pMask;
+	exa->fgbg = exa->dst_noalpha ? 0xff000000 : 0x00000000;
+	exa->blendercfg = G2D_BLENDERCFG_ENABLE |
+			G2D_BLENDERCFG_OOALPHA |
+			(pMask ? 0 : G2D_BLENDERCFG_NOMASK) |
+			(exa->dst_noalpha ? 0x00200000 : 0);
+	exa->gradient = pSrcPicture->repeat ? 0x1001 : 0x0;
+	exa->config = G2D_CONFIG_DST | G2D_CONFIG_SRC1 |
+			(pMask ? G2D_CONFIG_SRC2 : 0);
+
+	/* up to 24 dwords */
+	exa->tex.n = exa->tex.nrelocs = 0;
+	tmpl_dword (&exa->tex, TREG(G2D_GRADIENT) | 0x0);
+	tmpl_srcpix(&exa->tex, &exa->src);
+	if (pSrcPicture->repeat)
+		tmpl_dwords(&exa->tex, src_repeat, ARRAY_SIZE(src_repeat));
+	tmpl_dword (&exa->tex, TREG(GRADW_TEXCFG2) | 0x0);
+	if (pMask) {
+		tmpl_dword (&exa->tex, TREG(G2D_GRADIENT) | 0x20000);
+		tmpl_srcpix(&exa->tex, &exa->mask);
+		tmpl_dword (&exa->tex, TREG(GRADW_TEXCFG2) | GRADW_TEXCFG2_ALPHA_TEX);
+	}
+	if (!pSrcPicture->repeat)
+		tmpl_dword (&exa->tex, TREG(G2D_GRADIENT) | 0x0);
 
 	return TRUE;
 }
 
+/* clip the blit, relative to its dst rect, to where the picture sampled
+ * from (x, y) on is within its pixmap:
+ */
+static inline void
+clip_to_pix(const struct exa_pix *pix, int x, int y,
+		int *x0, int *y0, int *x1, int *y1)
+{
+	*x0 = max(*x0, -x);
+	*y0 = max(*y0, -y);
+	*x1 = min(*x1, (int)pix->w - x);
+	*y1 = min(*y1, (int)pix->h - y);
+}
+
+/* a repeating src can start anywhere, but G2D_SXY can't: */
+static inline int
+wrap_coord(int c, int size)
+{
+	c %= size;
+	return (c < 0) ? (c + size) : c;
+}
+
 /**
  * Composite() performs a Composite operation set up in the last
  * PrepareComposite() call.
@@ -649,8 +1274,14 @@ MSMComposite(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX, int maskY,
 		int dstX, int dstY, int width, int height)
 {
 	MSM_LOCALS(pDstPixmap);
-	PixmapPtr pSrcPixmap = exa->src;
-	PixmapPtr pMaskPixmap = exa->mask;
+
+#ifdef HAVE_XA
+	if (exa->use_xa) {
+		MSMHybridComposite(pDstPixmap, srcX, srcY, maskX, maskY,
+				dstX, dstY, width, height);
+		return;
+	}
+#endif
 
 	TRACE_EXA("COMPOSITE: srcX=%d\tsrcY=%d\tmaskX=%d\tmaskY=%d\t"
 			"dstX=%d\tdstY=%d\twidth=%d\theight=%d\t"
@@ -658,98 +1289,74 @@ MSMComposite(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX, int maskY,
 			srcX, srcY, maskX, maskY, dstX, dstY,
 			width, height, exa->srcpic->format, exa->dstpic->format);
 
-	BEGIN_RING(pMsm, 71);
-	ring = pMsm->ring.ring;
-	out_dstpix(ring, pDstPixmap);
-
-	if (!PICT_FORMAT_A(exa->dstpic->format)) {
-		OUT_RING(ring, REGM(G2D_FOREGROUND, 2));
-		OUT_RING(ring, 0xff000000);      /* G2D_FOREGROUND */
-		OUT_RING(ring, 0xff000000);      /* G2D_BACKGROUND */
-		OUT_RING(ring, REGM(G2D_CONST2, 1));
-		OUT_RING(ring, 0xff000000);
-	} else {
-		OUT_RING(ring, REG(G2D_FOREGROUND) | 0x000000);
-		OUT_RING(ring, REG(G2D_BACKGROUND) | 0x000000);
+	srcX  += exa->src_tx;
+	srcY  += exa->src_ty;
+	maskX += exa->mask_tx;
+	maskY += exa->mask_ty;
+
+	if (exa->clip_src || exa->clip_mask) {
+		int x0 = 0, y0 = 0, x1 = width, y1 = height;
+
+		if (exa->clip_src)
+			clip_to_pix(&exa->src, srcX, srcY, &x0, &y0, &x1, &y1);
+		if (exa->clip_mask)
+			clip_to_pix(&exa->mask, maskX, maskY, &x0, &y0, &x1, &y1);
+
+		if ((x0 >= x1) || (y0 >= y1))
+			return;
+
+		srcX  += x0;
+		srcY  += y0;
+		maskX += x0;
+		maskY += y0;
+		dstX  += x0;
+		dstY  += y0;
+		width  = x1 - x0;
+		height = y1 - y0;
 	}
 
-	if (!PICT_FORMAT_A(exa->srcpic->format)) {
-		OUT_RING(ring, REGM(G2D_CONST0, 1));
-		OUT_RING(ring, 0xff000000);
+	if (exa->srcpic->repeat) {
+		srcX = wrap_coord(srcX, exa->src.w);
+		srcY = wrap_coord(srcY, exa->src.h);
 	}
 
-	if (exa->op_dwords[0])
-		OUT_RING(ring, exa->op_dwords[0]);
-	OUT_RING(ring, exa->op_dwords[1]);
-	if (exa->op_dwords[2])
-		OUT_RING(ring, exa->op_dwords[2]);
-	OUT_RING(ring, exa->op_dwords[3]);
-
-	OUT_RING  (ring, REG(G2D_BLENDERCFG) |
-			G2D_BLENDERCFG_ENABLE |
-			G2D_BLENDERCFG_OOALPHA |
-			(pMaskPixmap ? 0 : G2D_BLENDERCFG_NOMASK) |
-			(PICT_FORMAT_A(exa->dstpic->format) ? 0 : 0x00200000));
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	out_srcpix(ring, pSrcPixmap);
-	if (exa->srcpic && exa->srcpic->repeat) {
-		/* magic: */
-		OUT_RING(ring, REGM(GRADW_INST0, 2));
-		OUT_RING(ring, 0x10080632);
-		OUT_RING(ring, 0x12098695);
-		OUT_RING(ring, REGM(GRADW_CONST0, 6));
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00400000);
-		OUT_RING(ring, 0x0088fa80);
-		OUT_RING(ring, 0x00400000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00890740);
-	}
-	OUT_RING  (ring, REG(GRADW_TEXCFG2) | 0x0);
-	if (pMaskPixmap) {
-		OUT_RING  (ring, REG(G2D_GRADIENT) | 0x20000);
-		out_srcpix(ring, pMaskPixmap);
-		OUT_RING  (ring, REG(GRADW_TEXCFG2) | GRADW_TEXCFG2_ALPHA_TEX);
-	}
-	if (!(exa->srcpic && exa->srcpic->repeat)) {
-		OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	}
+	BEGIN_RING(pMsm, 71);
+	ring = pMsm->ring.ring;
+	out_dstpix(pMsm, &exa->dst);
+	out_fgbg  (pMsm, exa->fgbg);
+	if (exa->dst_noalpha)
+		OUT_REG (pMsm, G2D_CONST2, 0xff000000);
+	if (exa->src_noalpha)
+		OUT_REG (pMsm, G2D_CONST0, 0xff000000);
+	OUT_REG   (pMsm, G2D_BLEND_A0, exa->blend_a0);
+	OUT_REG   (pMsm, G2D_BLEND_C0, exa->blend_c0);
+	OUT_REG   (pMsm, G2D_BLENDERCFG, exa->blendercfg);
+	out_template(pMsm, &exa->tex);
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, G2D_INPUT_SCOORD1));
-	if (pMaskPixmap) {
+	if (exa->has_mask) {
 		OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, G2D_INPUT_SCOORD2));
 	} else {
 		OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_SCOORD2));
 	}
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
 	OUT_RING  (ring, REG(G2D_INPUT) | idis(exa, G2D_INPUT_COLOR));
-	if (exa->srcpic && exa->srcpic->repeat) {
-		OUT_RING  (ring, REG(G2D_GRADIENT) | 0x1001);
-	} else {
-		OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	}
+	OUT_RING  (ring, REG(G2D_GRADIENT) | exa->gradient);
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(exa, 0));
-	OUT_RING  (ring, REG(G2D_CONFIG) |
-			G2D_CONFIG_DST | G2D_CONFIG_SRC1 |
-			(pMaskPixmap ? G2D_CONFIG_SRC2 : 0));
+	OUT_REG   (pMsm, G2D_CONFIG, exa->config);
 	OUT_RING  (ring, REGM(G2D_XY, 3));
 	OUT_RING  (ring, G2D_XY_X(dstX) | G2D_XY_Y(dstY));/* G2D_XY */
 	OUT_RING  (ring, G2D_WIDTHHEIGHT_WIDTH(width) |   /* G2D_WIDTHHEIGHT */
 			G2D_WIDTHHEIGHT_HEIGHT(height));
 	OUT_RING  (ring, G2D_SXYn_X(srcX) |               /* G2D_SXY */
 			G2D_SXYn_Y(srcY));
-	if (pMaskPixmap) {
+	if (exa->has_mask) {
 		OUT_RING  (ring, REGM(G2D_SXY2, 1));
 		OUT_RING  (ring, G2D_SXYn_X(maskX) |          /* G2D_SXY */
 				G2D_SXYn_Y(maskY));
 	}
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
-	OUT_RING  (ring, REG(G2D_GRADIENT) | 0x0);
+	OUT_RINGS (ring, blit_tail, ARRAY_SIZE(blit_tail));
 	END_RING  (pMsm);
 }
 
@@ -768,7 +1375,19 @@ MSMComposite(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX, int maskY,
 static void
 MSMDoneComposite(PixmapPtr pDst)
 {
+	MSM_LOCALS(pDst);
+
+#ifdef HAVE_XA
+	if (exa->use_xa) {
+		MSMHybridDoneComposite(pDst);
+		return;
+	}
+#endif
 
+	done_pix(pMsm, &exa->dst, TRUE);
+	done_pix(pMsm, &exa->src, FALSE);
+	if (exa->has_mask)
+		done_pix(pMsm, &exa->mask, FALSE);
 }
 
 /**
@@ -791,7 +1410,11 @@ MSMMarkSync(ScreenPtr pScreen)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	MSMPtr pMsm = MSMPTR(pScrn);
-	return pMsm->ring.timestamp;
+
+	/* the marker is a serial, as the latest submit may not have been
+	 * submitted (or have a timestamp) yet:
+	 */
+	return last_serial(pMsm);
 }
 
 
@@ -813,9 +1436,11 @@ MSMWaitMarker(ScreenPtr pScreen, int marker)
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	MSMPtr pMsm = MSMPTR(pScrn);
 	if (pMsm->pipe) {
-		FIRE_RING(pMsm);
-		TRACE_EXA("WAIT: %d", pMsm->ring.timestamp);
-		fd_pipe_wait(pMsm->pipe, pMsm->ring.timestamp);
+		/* this only submits if the marker is in the ringbuffer still
+		 * being built, and doesn't wait for anything queued after it:
+		 */
+		TRACE_EXA("WAIT: %d", marker);
+		msm_serial_wait(pMsm, marker, WAIT_MARKER);
 	}
 }
 
@@ -850,6 +1475,7 @@ MSMPrepareAccess(PixmapPtr pPixmap, int index)
 	};
 	MSM_LOCALS(pPixmap);
 	struct msm_pixmap_priv *priv;
+	uint64_t start;
 
 	priv = exaGetPixmapDriverPrivate(pPixmap);
 
@@ -859,7 +1485,19 @@ MSMPrepareAccess(PixmapPtr pPixmap, int index)
 	if (!priv->bo)
 		return TRUE;
 
-	fd_bo_cpu_prep(priv->bo, pMsm->pipe, usage[index]);
+	/* wait for our own rendering to the bo (or from it, if the cpu
+	 * is going to write), and no further:
+	 */
+	msm_serial_wait(pMsm, (usage[index] & DRM_FREEDRENO_PREP_WRITE) ?
+			priv->serial : priv->write_serial, WAIT_ACCESS);
+	hybrid_wait(pMsm, priv, usage[index] & DRM_FREEDRENO_PREP_WRITE);
+
+	/* which is all there is, unless others can get at the bo too: */
+	if (priv->exported) {
+		start = msm_time_us();
+		fd_bo_cpu_prep(priv->bo, pMsm->pipe, usage[index]);
+		msm_stats_wait(pMsm, WAIT_ACCESS, start);
+	}
 
 	pPixmap->devPrivate.ptr = fd_bo_map(priv->bo);
 
@@ -875,7 +1513,9 @@ MSMFinishAccess(PixmapPtr pPixmap, int index)
 	if (!priv || !priv->bo)
 		return;
 
-	fd_bo_cpu_fini(priv->bo);
+	if (priv->exported)
+		fd_bo_cpu_fini(priv->bo);
+	msm_capture_bo_dirty(priv->bo);
 
 	pPixmap->devPrivate.ptr = NULL;
 }
@@ -907,6 +1547,7 @@ MSMCreatePixmap2(ScreenPtr pScreen, int width, int height,
 		priv->bo = fd_bo_new(pMsm->dev, size,
 				DRM_FREEDRENO_GEM_TYPE_KMEM |
 				DRM_FREEDRENO_GEM_TYPE_SMI);
+		priv->exported = TRUE;
 	}
 
 	if (!priv->bo) {
@@ -929,8 +1570,16 @@ MSMDestroyPixmap(ScreenPtr pScreen, void *dpriv)
 	if (!priv)
 		return;
 
-	if (priv->bo)
+#ifdef HAVE_XA
+	if (priv->surf)
+		xa_surface_unref(priv->surf);
+#endif
+
+	if (priv->bo) {
+		shadow_forget_bo(MSMPTR_FROM_SCREEN(pScreen), priv->bo);
+		msm_capture_forget_bo(priv->bo);
 		fd_bo_del(priv->bo);
+	}
 
 	free(priv);
 }
@@ -1018,10 +1667,20 @@ MSMSetupExa(ScreenPtr pScreen, Bool softexa)
 
 	if (softexa) {
 		DEBUG_MSG("soft-exa");
-		pExa->PrepareSolid   = MSMPrepareSolidFail;
-		pExa->PrepareCopy    = MSMPrepareCopyFail;
-		pExa->PrepareComposite = MSMPrepareCompositeFail;
+		MSMDisableExa(pMsm);
 	}
 
 	return exaDriverInit(pScreen, pMsm->pExa);
 }
+
+/* fall back to software for all rendering, also used when the gpu is
+ * lost at runtime (EXA keeps using our ExaDriverRec, so this takes
+ * effect right away):
+ */
+void
+MSMDisableExa(MSMPtr pMsm)
+{
+	pMsm->pExa->PrepareSolid     = MSMPrepareSolidFail;
+	pMsm->pExa->PrepareCopy      = MSMPrepareCopyFail;
+	pMsm->pExa->PrepareComposite = MSMPrepareCompositeFail;
+}
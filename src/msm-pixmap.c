@@ -32,6 +32,7 @@
 #endif
 
 #include "msm.h"
+#include "msm-accel.h"
 
 #ifdef HAVE_XA
 #  include <xa_tracker.h>
@@ -71,8 +72,13 @@ msm_set_pixmap_bo(PixmapPtr pix, struct fd_bo *bo)
 	if (priv) {
 		struct fd_bo *old_bo = priv->bo;
 		priv->bo = bo ? fd_bo_ref(bo) : NULL;
-		if (old_bo)
+		/* it comes from somewhere else, so others may be using it: */
+		priv->exported = TRUE;
+		if (old_bo) {
+			shadow_forget_bo(MSMPTR_FROM_PIXMAP(pix), old_bo);
+			msm_capture_forget_bo(old_bo);
 			fd_bo_del(old_bo);
+		}
 #ifdef HAVE_XA
 		if (priv->surf) {
 			xa_surface_unref(priv->surf);
@@ -127,8 +133,10 @@ msm_get_pixmap_name(PixmapPtr pix, unsigned int *name, unsigned int *stride)
 		}
 #endif
 	} else {
+		struct msm_pixmap_priv *priv = exaGetPixmapDriverPrivate(pix);
 		struct fd_bo *bo = msm_get_pixmap_bo(pix);
 		if (bo) {
+			priv->exported = TRUE;
 			*stride = exaGetPixmapPitch(pix);
 			ret = fd_bo_get_name(bo, name);
 		}
@@ -144,6 +152,11 @@ msm_pixmap_exchange(PixmapPtr a, PixmapPtr b)
 	struct msm_pixmap_priv *bpriv = exaGetPixmapDriverPrivate(b);
 	exchange(apriv->bo, bpriv->bo);
 	exchange(apriv->ptr, bpriv->ptr);
+	exchange(apriv->serial, bpriv->serial);
+	exchange(apriv->write_serial, bpriv->write_serial);
+	exchange(apriv->exported, bpriv->exported);
+	exchange(apriv->xa_serial, bpriv->xa_serial);
+	exchange(apriv->xa_write_serial, bpriv->xa_write_serial);
 #ifdef HAVE_XA
 	exchange(apriv->surf, bpriv->surf);
 #endif
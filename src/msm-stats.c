@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <signal.h>
+#include <time.h>
+
+#include "msm.h"
+#include "msm-accel.h"
+
+/* Accounting of time spent blocked waiting for the gpu, so we can tell
+ * whether dropped frames are gpu stalls or cpu bound, and of how long
+ * rendering sits queued before it is submitted.  The histograms are
+ * dumped to the log at CloseScreen, or on demand with:
+ *
+ *    kill -USR2 <pid of X server>
+ */
+
+static const char *site_names[WAIT_NR] = {
+		[WAIT_RING]   = "ringbuffer",
+		[WAIT_MARKER] = "WaitMarker",
+		[WAIT_ACCESS] = "PrepareAccess",
+		[WAIT_RECOVER] = "hang recovery",
+		[WAIT_SUSPEND] = "LeaveVT",
+		[WAIT_IDLE]   = "idle trim",
+		[WAIT_CLOSE]  = "CloseScreen",
+		[WAIT_HYBRID] = "2D/3D dependencies",
+};
+
+static const char *flush_names[FLUSH_NR] = {
+		[FLUSH_FULL]      = "full",
+		[FLUSH_SYNC]      = "sync",
+		[FLUSH_SCANOUT]   = "scanout",
+		[FLUSH_THRESHOLD] = "threshold",
+		[FLUSH_DEADLINE]  = "deadline",
+};
+
+static volatile sig_atomic_t dump_requested;
+
+uint64_t
+msm_time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+void
+msm_stats_add(struct msm_wait_stats *stats, uint32_t us)
+{
+	uint32_t v = us;
+	int b = 0;
+
+	while (v && (b < (WAIT_BUCKETS - 1))) {
+		v >>= 1;
+		b++;
+	}
+
+	stats->buckets[b]++;
+	stats->count++;
+	stats->total += us;
+	stats->max = max(stats->max, us);
+}
+
+void
+msm_stats_wait(MSMPtr pMsm, enum msm_wait_site site, uint64_t start)
+{
+	msm_stats_add(&pMsm->waits[site], msm_time_us() - start);
+}
+
+static void
+stats_signal(int sig)
+{
+	dump_requested = 1;
+}
+
+void
+msm_stats_init(ScrnInfoPtr pScrn)
+{
+	OsSignal(SIGUSR2, stats_signal);
+}
+
+/* called from the BlockHandler, since we can't log from the signal
+ * handler itself:
+ */
+void
+msm_stats_poll(ScrnInfoPtr pScrn)
+{
+	if (dump_requested) {
+		dump_requested = 0;
+		msm_stats_dump(pScrn);
+	}
+}
+
+static void
+dump_buckets(ScrnInfoPtr pScrn, const struct msm_wait_stats *stats)
+{
+	int b;
+
+	for (b = 0; b < WAIT_BUCKETS; b++) {
+		if (!stats->buckets[b])
+			continue;
+		if (b == 0)
+			INFO_MSG("          <1us: %u", stats->buckets[b]);
+		else if (b == (WAIT_BUCKETS - 1))
+			INFO_MSG("  >=%uus: %u", 1 << (b - 1), stats->buckets[b]);
+		else
+			INFO_MSG("  %6u-%uus: %u", 1 << (b - 1), (1 << b) - 1,
+					stats->buckets[b]);
+	}
+}
+
+void
+msm_stats_dump(ScrnInfoPtr pScrn)
+{
+	MSMPtr pMsm = MSMPTR(pScrn);
+	int i;
+
+	INFO_MSG("GPU submits: %u, avg %u dwords", pMsm->ring.submits,
+			pMsm->ring.submits ? (uint32_t)(pMsm->ring.submit_dwords /
+					pMsm->ring.submits) : 0);
+	INFO_MSG("GPU relocs: %llu, %llu more deduplicated",
+			(unsigned long long)pMsm->ring.relocs,
+			(unsigned long long)pMsm->ring.reloc_dups);
+
+	for (i = 0; i < FLUSH_NR; i++)
+		INFO_MSG("GPU submits on %s: %u", flush_names[i],
+				pMsm->ring.flushes[i]);
+	INFO_MSG("GPU submits held back by BlockHandler: %u",
+			pMsm->ring.deferred);
+	INFO_MSG("GPU hangs: %u, recovered %u%s", pMsm->ring.hangs,
+			pMsm->ring.recoveries, pMsm->ring.lost ? ", GPU lost" : "");
+	INFO_MSG("GPU submit latency: avg %uus, max %uus",
+			pMsm->ring.latency.count ? (uint32_t)(pMsm->ring.latency.total /
+					pMsm->ring.latency.count) : 0,
+			pMsm->ring.latency.max);
+	dump_buckets(pScrn, &pMsm->ring.latency);
+
+	for (i = 0; i < WAIT_NR; i++) {
+		struct msm_wait_stats *stats = &pMsm->waits[i];
+
+		INFO_MSG("GPU waits in %s: %u, total %llums, max %uus",
+				site_names[i], stats->count,
+				(unsigned long long)(stats->total / 1000), stats->max);
+
+		dump_buckets(pScrn, stats);
+	}
+}
@@ -43,6 +43,11 @@ struct xa_surface;
 
 #define CREATE_PIXMAP_USAGE_DRI2 0x10000000
 
+#define MSM_MAX_RINGS 32
+
+/* number of recent submits whose timestamps are remembered: */
+#define MSM_SERIALS 64
+
 #ifndef ARRAY_SIZE
 #  define ARRAY_SIZE(a) (sizeof((a)) / (sizeof(*(a))))
 #endif
@@ -57,9 +62,55 @@ typedef enum
 	OPTION_SWREFRESHER,
 	OPTION_VSYNC,
 	OPTION_DEBUG,
+	OPTION_MIN_RINGS,
+	OPTION_MAX_RINGS,
+	OPTION_MIN_RING_SIZE,
+	OPTION_MAX_RING_SIZE,
+	OPTION_CAPTURE_FILE,
+	OPTION_FLUSH_DEADLINE,
+	OPTION_FLUSH_THRESHOLD,
+	OPTION_HANG_TIMEOUT,
+	OPTION_HYBRID,
+	OPTION_RASTER_OPS,
 } MSMOpts;
 
 struct exa_state;
+struct msm_hybrid;
+
+/* call sites which can stall waiting for the gpu, for the stall stats: */
+enum msm_wait_site {
+	WAIT_RING,          /* all ringbuffers busy, in next_ring() */
+	WAIT_MARKER,        /* MSMWaitMarker() */
+	WAIT_ACCESS,        /* MSMPrepareAccess() */
+	WAIT_RECOVER,       /* checking the gpu works after a hang */
+	WAIT_SUSPEND,       /* idling the gpu on LeaveVT */
+	WAIT_IDLE,          /* trimming the ringbuffer pool when idle */
+	WAIT_CLOSE,         /* draining the gpu in CloseScreen */
+	WAIT_HYBRID,        /* one pipe waiting on the other, in hybrid mode */
+	WAIT_NR
+};
+
+/* log2 buckets of microseconds, the first being <1us and the last
+ * catching anything over ~4s:
+ */
+#define WAIT_BUCKETS 24
+
+struct msm_wait_stats {
+	uint32_t buckets[WAIT_BUCKETS];
+	uint32_t count;
+	uint32_t max;       /* us */
+	uint64_t total;     /* us */
+};
+
+/* why a ringbuffer was submitted, for the stats: */
+enum msm_flush_reason {
+	FLUSH_FULL,         /* out of space, in BEGIN_RING() */
+	FLUSH_SYNC,         /* someone is waiting for the result */
+	FLUSH_SCANOUT,      /* rendering to the scanout */
+	FLUSH_THRESHOLD,    /* ringbuffer filled past FlushThreshold */
+	FLUSH_DEADLINE,     /* oldest rendering queued for FlushDeadline */
+	FLUSH_NR
+};
 
 typedef struct _MSMRec
 {
@@ -74,6 +125,8 @@ typedef struct _MSMRec
 
 	Bool NoKMS;
 	Bool NoAccel;
+	Bool HybridAccel;
+	Bool RasterOps;
 	Bool HWCursor;
 	Bool SWRefresher;
 
@@ -84,26 +137,121 @@ typedef struct _MSMRec
 	struct fd_device *dev;
 	char *deviceName;
 
-	/* for now just a single ringbuffer.. not sure if we need more..
-	 * probably would like more until context restore works in a sane
-	 * way..
+	/* pool of ringbuffers.  Submitted ringbuffers sit in the busy list
+	 * (oldest submit first, so it is ordered by timestamp) until the gpu
+	 * is done with them, and then move to the idle list for reuse.  Each
+	 * keeps a reference to one of the bos its submit used, so whether it
+	 * is done can be asked without blocking.  New ringbuffers are
+	 * allocated on demand, up to max_rings, rather than waiting on a
+	 * busy one.  The ringbuffer size grows when we keep
+	 * having to flush because the ringbuffer is full, and after a while
+	 * without any rendering the pool shrinks back to min_rings/min_size:
 	 */
 	struct {
-		int idx;
-		struct fd_ringbuffer *rings[8];
+		struct {
+			struct fd_ringbuffer *ring;
+			uint32_t timestamp;
+			struct fd_bo *probe;    /* or NULL */
+		} busy[MSM_MAX_RINGS];
+		int busy_head, nbusy;
+		struct fd_ringbuffer *idle[MSM_MAX_RINGS];
+		int nidle;
+		int nrings, min_rings, max_rings;
+		uint32_t size, min_size, max_size;   /* in bytes, excluding state */
+		int full_flushes;
+		OsTimerPtr idle_timer;
 		struct fd_ringbuffer *ring;
 		struct fd_bo *context_bos[3];
+		/* bounce buffer for copies which overlap themselves, allocated
+		 * on first use (see bounce_copy()):
+		 */
+		struct fd_bo *scratch;
+		/* pre-patched initial state, copied into new ringbuffers: */
+		struct fd_ringbuffer *state;
 		Bool fire;
+		/* rendering is not submitted on every BlockHandler, but held
+		 * back until it has been queued for flush_deadline (ms) or the
+		 * ringbuffer is flush_threshold (%) full, so bursts of small
+		 * requests end up in the same submit.  Unless it touches the
+		 * scanout, or someone waits on it, then it goes right away:
+		 */
+		uint32_t flush_deadline, flush_threshold;
+		uint64_t pending;       /* time the oldest queued rendering was queued */
+		Bool flush_now;
+		OsTimerPtr flush_timer;
+		/* serial number of the submit being built, and the timestamps
+		 * of the submits before it (indexed by serial % MSM_SERIALS).
+		 * Serials are known before the submit has a timestamp, so they
+		 * are what pixmaps record as their last use:
+		 */
+		uint32_t serial;
+		uint32_t serial_timestamps[MSM_SERIALS];
 		uint32_t timestamp;
+		/* most recent timestamp known to have retired: */
+		uint32_t retired;
+		/* a wait which takes longer than hang_timeout (ms, 0 to wait
+		 * forever) means the gpu is hung.  Until it is recovered at the
+		 * next BlockHandler, nothing waits on it.  If recovery fails,
+		 * the gpu is lost and we stick to software rendering:
+		 */
+		uint32_t hang_timeout;
+		Bool hung, lost;
+		uint32_t hang_timestamp;    /* what we were waiting for */
+		uint64_t hang_start;        /* when we started waiting */
+		uint32_t hangs, recoveries;
+		/* switched away from our VT, so the context needs to be set
+		 * up again (see MSMResumeAccel()):
+		 */
+		Bool suspended;
+		/* submit count and size, for the stats: */
+		uint32_t submits;
+		uint64_t submit_dwords;
+		/* relocs emitted, and the ones skipped by OUT_BO(): */
+		uint64_t relocs, reloc_dups;
+		/* submits per reason, BlockHandlers which held back queued
+		 * rendering, and time from queueing to submit:
+		 */
+		uint32_t flushes[FLUSH_NR];
+		uint32_t deferred;
+		struct msm_wait_stats latency;
+
+		/* shadow of the register state emitted so far into the current
+		 * ringbuffer, so redundant state writes can be skipped.  Reset
+		 * whenever we cycle to the next ringbuffer:
+		 */
+		struct {
+			uint32_t val[0x100];
+			uint32_t valid[0x100 / 32];
+			/* destination texture state (set up by out_dstpix()): */
+			struct fd_bo *dst;
+			uint32_t dst_texsize, dst_texcfg;
+			/* bos referenced so far, and the address their first
+			 * reloc resolved to (see OUT_BO()):
+			 */
+			struct {
+				struct fd_bo *bo;
+				uint32_t addr;
+				Bool write;
+			} bos[8];
+			int nbos;
+		} shadow;
 	} ring;
 	struct fd_pipe *pipe;
 
+	/* time spent blocked on the gpu, per call site: */
+	struct msm_wait_stats waits[WAIT_NR];
+
 	/* for XA state tracker EXA: */
 	struct xa_tracker *xa;
 
 	/* EXA state: */
 	struct exa_state *exa;
 
+	/* XA on the 3D pipe alongside the 2D pipe, for the composites the
+	 * 2D core can't do (see msm-exa-xa.c), or NULL:
+	 */
+	struct msm_hybrid *hybrid;
+
 	struct fd_bo *scanout;
 	struct xa_surface *scanout_surf;
 
@@ -114,6 +262,15 @@ struct msm_pixmap_priv {
 	struct fd_bo *bo;        /* for traditional 2d EXA */
 	struct xa_surface *surf; /* for XA state tracker EXA */
 	void *ptr;               /* for unacceleratable pixmaps */
+	/* serials of the last submits which read or wrote the bo, and
+	 * whether someone besides us (clients, the display) may use it:
+	 */
+	uint32_t serial, write_serial;
+	Bool exported;
+	/* same for XA rendering, in hybrid mode, as MSMHybridWait() counts
+	 * it (the surf then wraps the bo):
+	 */
+	uint32_t xa_serial, xa_write_serial;
 };
 
 /* Macro to get the private record from the ScreenInfo structure */
@@ -127,9 +284,25 @@ struct msm_pixmap_priv {
 
 Bool MSMSetupAccel(ScreenPtr pScreen);
 void MSMFlushAccel(ScreenPtr pScreen);
+void MSMBlockAccel(ScreenPtr pScreen);
+void MSMSuspendAccel(ScrnInfoPtr pScrn);
+void MSMResumeAccel(ScrnInfoPtr pScrn);
+void MSMCloseAccel(ScreenPtr pScreen);
 Bool MSMSetupExa(ScreenPtr, Bool softexa);
+void MSMDisableExa(MSMPtr pMsm);
 Bool MSMSetupExaXA(ScreenPtr);
 void MSMFlushXA(MSMPtr pMsm);
+Bool MSMSetupHybridXA(ScreenPtr);
+void MSMHybridFlush(MSMPtr pMsm, Bool wait);
+void MSMHybridWait(MSMPtr pMsm, struct msm_pixmap_priv *priv, Bool write);
+Bool MSMHybridCheckComposite(int op, PicturePtr pSrcPicture,
+		PicturePtr pMaskPicture, PicturePtr pDstPicture);
+Bool MSMHybridPrepareComposite(int op, PicturePtr pSrcPicture,
+		PicturePtr pMaskPicture, PicturePtr pDstPicture,
+		PixmapPtr pSrc, PixmapPtr pMask, PixmapPtr pDst);
+void MSMHybridComposite(PixmapPtr pDst, int srcX, int srcY,
+		int maskX, int maskY, int dstX, int dstY, int width, int height);
+void MSMHybridDoneComposite(PixmapPtr pDst);
 
 typedef struct _MSMDRISwapCmd MSMDRISwapCmd;
 void MSMDRI2SwapComplete(MSMDRISwapCmd *cmd, uint32_t frame,
@@ -0,0 +1,587 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Microbenchmark for the cpu cost of the EXA hooks, ie. of building the
+ * command stream for each Solid/Copy/Composite:
+ *
+ *    exa-bench [-n ops] [-e] [-v]
+ *
+ *    -n   number of calls per case (default 10000)
+ *    -e   also render with the software emulator on flush (so the times
+ *         include the emulation), to check nothing emitted is unknown
+ *    -v   print every case, not just the totals per hook
+ *
+ * The driver's own msm-exa.c/msm-accel.c are linked against fake-drm.c,
+ * with just enough of the X server stubbed out to call the hooks.  Solid
+ * and Copy are run for each dst depth, and Composite for every op and
+ * src/mask/dst format and src repeat combination that MSMCheckComposite()
+ * and MSMPrepareComposite() accept.  For each we report the time per
+ * call (including the share of the Done*() call, which may emit what was
+ * queued up), and the dwords and relocs emitted per call (including the
+ * share of the per-submit overhead) and the number of flushes per 1000 calls
+ * due to the ringbuffer filling up.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "msm.h"
+#include "msm-accel.h"
+
+#include "fake-drm.h"
+#include "z1xx-emu.h"
+
+#define DST_SIZE   256
+#define SRC_SIZE   64
+
+static int verbose;
+
+static ScreenRec screen;
+static ScrnInfoRec scrn;
+static MSMRec msm;
+
+/*
+ * The bits of the X server which the driver code calls:
+ */
+
+Bool msmDebug = FALSE;
+
+ScrnInfoPtr
+xf86ScreenToScrn(ScreenPtr pScreen)
+{
+	return &scrn;
+}
+
+void
+xf86DrvMsg(int scrnIndex, MessageType type, const char *format, ...)
+{
+	va_list ap;
+
+	if (!verbose && (type != X_ERROR))
+		return;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+void
+ErrorF(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+pointer
+xf86LoadSubModule(ScrnInfoPtr pScrn, const char *name)
+{
+	return NULL;
+}
+
+OsSigHandlerPtr
+OsSignal(int sig, OsSigHandlerPtr handler)
+{
+	return NULL;
+}
+
+OsTimerPtr
+TimerSet(OsTimerPtr timer, int flags, CARD32 millis,
+		OsTimerCallback func, pointer arg)
+{
+	return NULL;
+}
+
+void
+TimerFree(OsTimerPtr timer)
+{
+}
+
+void
+TimerCancel(OsTimerPtr timer)
+{
+}
+
+ExaDriverPtr
+exaDriverAlloc(void)
+{
+	return calloc(1, sizeof(ExaDriverRec));
+}
+
+Bool
+exaDriverInit(ScreenPtr pScreen, ExaDriverPtr pExa)
+{
+	return TRUE;
+}
+
+struct bench_pixmap {
+	PixmapRec pix;
+	void *priv;
+};
+
+void *
+exaGetPixmapDriverPrivate(PixmapPtr pix)
+{
+	return ((struct bench_pixmap *)pix)->priv;
+}
+
+unsigned long
+exaGetPixmapPitch(PixmapPtr pix)
+{
+	return pix->devKind;
+}
+
+Bool
+MSMDRI2ScreenInit(ScreenPtr pScreen)
+{
+	return FALSE;
+}
+
+#ifdef HAVE_XA
+Bool
+MSMSetupExaXA(ScreenPtr pScreen)
+{
+	return FALSE;
+}
+
+void
+MSMFlushXA(MSMPtr pMsm)
+{
+}
+
+/* hybrid mode is never enabled here, so these are never called: */
+Bool
+MSMSetupHybridXA(ScreenPtr pScreen)
+{
+	return FALSE;
+}
+
+void
+MSMHybridFlush(MSMPtr pMsm, Bool wait)
+{
+}
+
+void
+MSMHybridWait(MSMPtr pMsm, struct msm_pixmap_priv *priv, Bool write)
+{
+}
+
+Bool
+MSMHybridCheckComposite(int op, PicturePtr pSrcPicture,
+		PicturePtr pMaskPicture, PicturePtr pDstPicture)
+{
+	return FALSE;
+}
+
+Bool
+MSMHybridPrepareComposite(int op, PicturePtr pSrcPicture,
+		PicturePtr pMaskPicture, PicturePtr pDstPicture,
+		PixmapPtr pSrc, PixmapPtr pMask, PixmapPtr pDst)
+{
+	return FALSE;
+}
+
+void
+MSMHybridComposite(PixmapPtr pDst, int srcX, int srcY,
+		int maskX, int maskY, int dstX, int dstY, int width, int height)
+{
+}
+
+void
+MSMHybridDoneComposite(PixmapPtr pDst)
+{
+}
+#endif
+
+/*
+ * The benchmark:
+ */
+
+struct result {
+	uint32_t cases, calls;
+	uint64_t ns, dwords, relocs, flushes;
+};
+
+static struct {
+	const char *name;
+	uint32_t format;
+} formats[] = {
+		{ "a8r8g8b8", PICT_a8r8g8b8 },
+		{ "a8b8g8r8", PICT_a8b8g8r8 },
+		{ "x8r8g8b8", PICT_x8r8g8b8 },
+		{ "x8b8g8r8", PICT_x8b8g8r8 },
+		{ "a8",       PICT_a8 },
+};
+
+static const char *op_names[] = {
+		"Clear", "Src", "Dst", "Over", "OverReverse", "In", "InReverse",
+		"Out", "OutReverse", "Atop", "AtopReverse", "Xor", "Add",
+};
+
+static const char *alu_names[] = {
+		"GXclear", "GXand", "GXandReverse", "GXcopy", "GXandInverted",
+		"GXnoop", "GXxor", "GXor", "GXnor", "GXequiv", "GXinvert",
+		"GXorReverse", "GXcopyInverted", "GXorInverted", "GXnand", "GXset",
+};
+
+static const char *
+format_name(uint32_t format)
+{
+	int i;
+	for (i = 0; i < ARRAY_SIZE(formats); i++)
+		if (formats[i].format == format)
+			return formats[i].name;
+	return "?";
+}
+
+static uint64_t
+time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static PixmapPtr
+create_pixmap(int width, int height, int depth)
+{
+	struct bench_pixmap *bpix = calloc(1, sizeof(*bpix));
+	PixmapPtr pix = &bpix->pix;
+	int bpp = (depth == 8) ? 8 : (depth == 16) ? 16 : 32;
+	int pitch;
+
+	bpix->priv = msm.pExa->CreatePixmap2(&screen, width, height,
+			depth, 0, bpp, &pitch);
+	if (!bpix->priv) {
+		fprintf(stderr, "could not create %dx%d pixmap\n", width, height);
+		exit(1);
+	}
+
+	pix->drawable.pScreen = &screen;
+	pix->drawable.width = width;
+	pix->drawable.height = height;
+	pix->drawable.depth = depth;
+	pix->drawable.bitsPerPixel = bpp;
+	pix->devKind = pitch;
+
+	return pix;
+}
+
+static void
+init_picture(PicturePtr pic, PixmapPtr pix, uint32_t format)
+{
+	memset(pic, 0, sizeof(*pic));
+	pic->pDrawable = &pix->drawable;
+	pic->format = format;
+}
+
+static PixmapPtr
+pixmap_for(PixmapPtr pix32, PixmapPtr pix8, uint32_t format)
+{
+	return (format == PICT_a8) ? pix8 : pix32;
+}
+
+/* snapshot of the counters, to diff around each case: */
+struct counters {
+	uint64_t dwords, relocs, flushes;
+};
+
+static void
+get_counters(struct counters *c)
+{
+	const struct fake_drm_stats *stats = fake_drm_stats(msm.pipe);
+	c->dwords = msm.ring.submit_dwords;
+	c->relocs = stats->relocs;
+	c->flushes = stats->flushes;
+}
+
+static void
+begin_case(struct counters *c, uint64_t *start)
+{
+	/* start each case from a freshly flushed ringbuffer: */
+	MSMFlushAccel(&screen);
+	get_counters(c);
+	*start = time_ns();
+}
+
+static void
+end_case(struct result *r, const char *name, uint32_t calls,
+		const struct counters *before, uint64_t start)
+{
+	uint64_t ns = time_ns() - start;
+	struct counters mid, after;
+
+	/* flushes due to the ringbuffer filling up, not the final one: */
+	get_counters(&mid);
+
+	MSMFlushAccel(&screen);
+	get_counters(&after);
+
+	if (verbose) {
+		printf("%-56s %8.1f %8.2f %8.2f %8.2f\n", name,
+				(double)ns / calls,
+				(double)(after.dwords - before->dwords) / calls,
+				(double)(after.relocs - before->relocs) / calls,
+				(double)(mid.flushes - before->flushes) * 1000 / calls);
+	}
+
+	r->cases++;
+	r->calls += calls;
+	r->ns += ns;
+	r->dwords += after.dwords - before->dwords;
+	r->relocs += after.relocs - before->relocs;
+	r->flushes += mid.flushes - before->flushes;
+}
+
+static void
+bench_solid(struct result *r, int alu, PixmapPtr dst, uint32_t n)
+{
+	ExaDriverPtr pExa = msm.pExa;
+	struct counters c;
+	uint64_t start;
+	char name[64];
+	uint32_t i;
+
+	if (!pExa->PrepareSolid(dst, alu, FB_ALLONES, 0xff00ff00))
+		return;
+
+	snprintf(name, sizeof(name), "solid %s depth %d",
+			alu_names[alu], dst->drawable.depth);
+
+	begin_case(&c, &start);
+	for (i = 0; i < n; i++) {
+		int x = i % (DST_SIZE - 16), y = (i / 7) % (DST_SIZE - 16);
+		pExa->Solid(dst, x, y, x + 16, y + 16);
+	}
+	pExa->DoneSolid(dst);
+	end_case(r, name, n, &c, start);
+}
+
+static void
+bench_copy(struct result *r, int alu, PixmapPtr src, PixmapPtr dst,
+		uint32_t n)
+{
+	ExaDriverPtr pExa = msm.pExa;
+	struct counters c;
+	uint64_t start;
+	char name[64];
+	uint32_t i;
+
+	if (!pExa->PrepareCopy(src, dst, 1, 1, alu, FB_ALLONES))
+		return;
+
+	snprintf(name, sizeof(name), "copy %s depth %d -> %d", alu_names[alu],
+			src->drawable.depth, dst->drawable.depth);
+
+	begin_case(&c, &start);
+	for (i = 0; i < n; i++) {
+		int x = i % (DST_SIZE - 16), y = (i / 7) % (DST_SIZE - 16);
+		pExa->Copy(dst, i % (SRC_SIZE - 16), 0, x, y, 16, 16);
+	}
+	pExa->DoneCopy(dst);
+	end_case(r, name, n, &c, start);
+}
+
+static void
+bench_composite(struct result *r, int op, PicturePtr srcpic,
+		PicturePtr maskpic, PicturePtr dstpic, uint32_t n)
+{
+	ExaDriverPtr pExa = msm.pExa;
+	PixmapPtr src = (PixmapPtr)srcpic->pDrawable;
+	PixmapPtr mask = maskpic ? (PixmapPtr)maskpic->pDrawable : NULL;
+	PixmapPtr dst = (PixmapPtr)dstpic->pDrawable;
+	struct counters c;
+	uint64_t start;
+	char name[64];
+	uint32_t i;
+
+	if (!pExa->CheckComposite(op, srcpic, maskpic, dstpic) ||
+			!pExa->PrepareComposite(op, srcpic, maskpic, dstpic,
+					src, mask, dst))
+		return;
+
+	snprintf(name, sizeof(name), "composite %s %s%s%s%s -> %s",
+			op_names[op], format_name(srcpic->format),
+			srcpic->repeat ? " (repeat)" : "",
+			maskpic ? " IN " : "",
+			maskpic ? format_name(maskpic->format) : "",
+			format_name(dstpic->format));
+
+	begin_case(&c, &start);
+	for (i = 0; i < n; i++) {
+		int x = i % (DST_SIZE - 16), y = (i / 7) % (DST_SIZE - 16);
+		pExa->Composite(dst, i % (SRC_SIZE - 16), 0, 0, i % (SRC_SIZE - 16),
+				x, y, 16, 16);
+	}
+	pExa->DoneComposite(dst);
+	end_case(r, name, n, &c, start);
+}
+
+static void
+print_result(const char *name, const struct result *r)
+{
+	if (!r->calls) {
+		printf("%-12s %6u\n", name, 0);
+		return;
+	}
+
+	printf("%-12s %6u %8.1f %8.2f %8.2f %8.2f\n", name, r->cases,
+			(double)r->ns / r->calls,
+			(double)r->dwords / r->calls,
+			(double)r->relocs / r->calls,
+			(double)r->flushes * 1000 / r->calls);
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n ops] [-e] [-v]\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct result solid = {0}, copy = {0}, composite = {0};
+	PixmapPtr dst32, dst24, dst16, dst8, src32, src16, src8, mask32, mask8;
+	PictureRec dstpic, srcpic, maskpic;
+	uint32_t n = 10000;
+	int c, op, d, s, m, repeat, emulate = 0;
+
+	while ((c = getopt(argc, argv, "n:ev")) != -1) {
+		switch (c) {
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			emulate = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if ((optind != argc) || !n)
+		usage(argv[0]);
+
+	/* same defaults as the driver: */
+	scrn.driverPrivate = &msm;
+	msm.ring.min_rings = 2;
+	msm.ring.max_rings = MSM_MAX_RINGS;
+	msm.ring.size = msm.ring.min_size = 16 * 1024;
+	msm.ring.max_size = 64 * 1024;
+	/* the GXxor/GXinvert cases, checked against the emulator's model of
+	 * G2D_ROP rather than the hw:
+	 */
+	msm.RasterOps = TRUE;
+
+	msm.dev = fd_device_new(-1);
+	if (!msm.dev || !MSMSetupAccel(&screen) || !msm.ring.ring) {
+		fprintf(stderr, "could not set up acceleration\n");
+		return 1;
+	}
+
+	fake_drm_emulate(msm.pipe, emulate);
+
+	dst32  = create_pixmap(DST_SIZE, DST_SIZE, 32);
+	dst24  = create_pixmap(DST_SIZE, DST_SIZE, 24);
+	dst16  = create_pixmap(DST_SIZE, DST_SIZE, 16);
+	dst8   = create_pixmap(DST_SIZE, DST_SIZE, 8);
+	src32  = create_pixmap(SRC_SIZE, SRC_SIZE, 32);
+	src16  = create_pixmap(SRC_SIZE, SRC_SIZE, 16);
+	src8   = create_pixmap(SRC_SIZE, SRC_SIZE, 8);
+	mask32 = create_pixmap(SRC_SIZE, SRC_SIZE, 32);
+	mask8  = create_pixmap(SRC_SIZE, SRC_SIZE, 8);
+
+	if (verbose)
+		printf("%-56s %8s %8s %8s %8s\n", "case",
+				"ns/call", "dwords", "relocs", "flush/1k");
+
+	bench_solid(&solid, GXcopy, dst32, n);
+	bench_solid(&solid, GXcopy, dst24, n);
+	bench_solid(&solid, GXcopy, dst16, n);
+	bench_solid(&solid, GXcopy, dst8, n);
+	bench_solid(&solid, GXxor, dst32, n);
+	bench_solid(&solid, GXinvert, dst32, n);
+
+	bench_copy(&copy, GXcopy, src32, dst32, n);
+	bench_copy(&copy, GXcopy, src32, dst24, n);
+	bench_copy(&copy, GXcopy, src16, dst16, n);
+	bench_copy(&copy, GXcopy, src8, dst8, n);
+	bench_copy(&copy, GXxor, src32, dst32, n);
+
+	for (op = 0; op <= PictOpAdd; op++) {
+		for (d = 0; d < ARRAY_SIZE(formats); d++) {
+			for (s = 0; s < ARRAY_SIZE(formats); s++) {
+				for (m = -1; m < (int)ARRAY_SIZE(formats); m++) {
+					for (repeat = 0; repeat < 2; repeat++) {
+						init_picture(&dstpic, pixmap_for(dst32, dst8,
+								formats[d].format), formats[d].format);
+						init_picture(&srcpic, pixmap_for(src32, src8,
+								formats[s].format), formats[s].format);
+						srcpic.repeat = repeat;
+						srcpic.repeatType = RepeatNormal;
+						if (m >= 0) {
+							init_picture(&maskpic, pixmap_for(mask32, mask8,
+									formats[m].format), formats[m].format);
+						}
+						bench_composite(&composite, op, &srcpic,
+								(m >= 0) ? &maskpic : NULL, &dstpic, n);
+					}
+				}
+			}
+		}
+	}
+
+	if (verbose)
+		printf("\n");
+
+	printf("%-12s %6s %8s %8s %8s %8s\n", "hook", "cases",
+			"ns/call", "dwords", "relocs", "flush/1k");
+	print_result("solid", &solid);
+	print_result("copy", &copy);
+	print_result("composite", &composite);
+
+	if (emulate) {
+		struct z1xx_emu *e = fake_drm_emu(msm.pipe);
+		printf("emulated %llu blits, %llu pixels, %u unknown, %u faults\n",
+				(unsigned long long)e->blits,
+				(unsigned long long)e->pixels, e->unknown, e->faults);
+		if (e->unknown || e->faults)
+			return 1;
+	}
+
+	return 0;
+}
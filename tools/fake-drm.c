@@ -0,0 +1,377 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Stand-in for the parts of libdrm_freedreno used by the driver and the
+ * tools, with no kernel underneath: bos are plain host memory with fake
+ * gpu addresses, and flushing a 2D ringbuffer runs it through the z1xx
+ * emulator, which renders into the bos.  Everything is synchronous, so
+ * waits and cpu_prep never block.
+ *
+ * Linking this instead of libdrm_freedreno gives a headless backend for
+ * checking rendering and measuring what is emitted, on any host.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freedreno_drmif.h"
+#include "freedreno_ringbuffer.h"
+
+#include "fake-drm.h"
+#include "z1xx-emu.h"
+
+/* dwords reserved by the kernel at the start of each 2D ringbuffer: */
+#define STATE_SIZE  0x140
+
+#define GPUADDR_BASE   0x10000000
+#define GPUADDR_ALIGN  0x1000
+
+struct fd_device {
+	struct fd_bo *bos;      /* all live bos, for address lookup */
+	uint32_t next_gpuaddr;
+	uint32_t next_handle;
+};
+
+struct fd_pipe {
+	struct fd_device *dev;
+	enum fd_pipe_id id;
+	uint32_t timestamp;
+	int emulate;
+	struct z1xx_emu emu;
+	struct fake_drm_stats stats;
+};
+
+struct fd_bo {
+	struct fd_device *dev;
+	struct fd_bo *next;
+	void *map;
+	uint32_t size, gpuaddr, handle, name;
+	int refcnt;
+};
+
+struct z1xx_emu *
+fake_drm_emu(struct fd_pipe *pipe)
+{
+	return &pipe->emu;
+}
+
+void
+fake_drm_emulate(struct fd_pipe *pipe, int enable)
+{
+	pipe->emulate = enable;
+}
+
+const struct fake_drm_stats *
+fake_drm_stats(struct fd_pipe *pipe)
+{
+	return &pipe->stats;
+}
+
+static void *
+map_gpuaddr(void *arg, uint32_t gpuaddr, uint32_t size)
+{
+	struct fd_device *dev = arg;
+	struct fd_bo *bo;
+
+	for (bo = dev->bos; bo; bo = bo->next) {
+		if ((gpuaddr >= bo->gpuaddr) &&
+				((gpuaddr - bo->gpuaddr) + (uint64_t)size <= bo->size))
+			return (uint8_t *)bo->map + (gpuaddr - bo->gpuaddr);
+	}
+
+	return NULL;
+}
+
+struct fd_device *
+fd_device_new(int fd)
+{
+	struct fd_device *dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+	dev->next_gpuaddr = GPUADDR_BASE;
+	dev->next_handle = 1;
+	return dev;
+}
+
+void
+fd_device_del(struct fd_device *dev)
+{
+	free(dev);
+}
+
+struct fd_pipe *
+fd_pipe_new(struct fd_device *dev, enum fd_pipe_id id)
+{
+	struct fd_pipe *pipe = calloc(1, sizeof(*pipe));
+	if (!pipe)
+		return NULL;
+	pipe->dev = dev;
+	pipe->id = id;
+	pipe->emulate = 1;
+	z1xx_emu_init(&pipe->emu, map_gpuaddr, dev);
+	return pipe;
+}
+
+void
+fd_pipe_del(struct fd_pipe *pipe)
+{
+	free(pipe);
+}
+
+int
+fd_pipe_get_param(struct fd_pipe *pipe, enum fd_param_id param,
+		uint64_t *value)
+{
+	switch (param) {
+	case FD_DEVICE_ID:
+	case FD_GPU_ID:
+		*value = 200;
+		return 0;
+	case FD_GMEM_SIZE:
+		*value = 256 * 1024;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+int
+fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
+{
+	return 0;
+}
+
+int
+fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
+		uint64_t timeout)
+{
+	return 0;
+}
+
+struct fd_bo *
+fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
+{
+	struct fd_bo *bo = calloc(1, sizeof(*bo));
+
+	if (!bo)
+		return NULL;
+
+	bo->map = calloc(1, size);
+	if (!bo->map) {
+		free(bo);
+		return NULL;
+	}
+
+	bo->dev = dev;
+	bo->size = size;
+	bo->gpuaddr = dev->next_gpuaddr;
+	bo->handle = dev->next_handle++;
+	bo->refcnt = 1;
+
+	/* never hand out an address twice, so stale addresses in a
+	 * ringbuffer fault rather than hit some other bo:
+	 */
+	dev->next_gpuaddr += (size + GPUADDR_ALIGN - 1) & ~(GPUADDR_ALIGN - 1);
+
+	bo->next = dev->bos;
+	dev->bos = bo;
+
+	return bo;
+}
+
+struct fd_bo *
+fd_bo_from_name(struct fd_device *dev, uint32_t name)
+{
+	struct fd_bo *bo;
+
+	for (bo = dev->bos; bo; bo = bo->next)
+		if (bo->name && (bo->name == name))
+			return fd_bo_ref(bo);
+
+	return NULL;
+}
+
+struct fd_bo *
+fd_bo_from_fbdev(struct fd_pipe *pipe, int fbfd, uint32_t size)
+{
+	return fd_bo_new(pipe->dev, size, DRM_FREEDRENO_GEM_TYPE_SMI);
+}
+
+struct fd_bo *
+fd_bo_ref(struct fd_bo *bo)
+{
+	bo->refcnt++;
+	return bo;
+}
+
+void
+fd_bo_del(struct fd_bo *bo)
+{
+	struct fd_bo **p;
+
+	if (--bo->refcnt > 0)
+		return;
+
+	for (p = &bo->dev->bos; *p; p = &(*p)->next) {
+		if (*p == bo) {
+			*p = bo->next;
+			break;
+		}
+	}
+
+	free(bo->map);
+	free(bo);
+}
+
+int
+fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
+{
+	if (!bo->name)
+		bo->name = bo->handle;
+	*name = bo->name;
+	return 0;
+}
+
+uint32_t
+fd_bo_handle(struct fd_bo *bo)
+{
+	return bo->handle;
+}
+
+uint32_t
+fd_bo_size(struct fd_bo *bo)
+{
+	return bo->size;
+}
+
+void *
+fd_bo_map(struct fd_bo *bo)
+{
+	return bo->map;
+}
+
+int
+fd_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op)
+{
+	return 0;
+}
+
+void
+fd_bo_cpu_fini(struct fd_bo *bo)
+{
+}
+
+struct fd_ringbuffer *
+fd_ringbuffer_new(struct fd_pipe *pipe, uint32_t size)
+{
+	struct fd_ringbuffer *ring = calloc(1, sizeof(*ring));
+
+	if (!ring)
+		return NULL;
+
+	ring->start = calloc(1, size);
+	if (!ring->start) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->size = size;
+	ring->pipe = pipe;
+	ring->end = &ring->start[size / 4];
+
+	fd_ringbuffer_reset(ring);
+
+	return ring;
+}
+
+void
+fd_ringbuffer_del(struct fd_ringbuffer *ring)
+{
+	free(ring->start);
+	free(ring);
+}
+
+void
+fd_ringbuffer_set_parent(struct fd_ringbuffer *ring,
+		struct fd_ringbuffer *parent)
+{
+	ring->parent = parent;
+}
+
+void
+fd_ringbuffer_reset(struct fd_ringbuffer *ring)
+{
+	uint32_t *start = ring->start;
+
+	/* like kgsl, the start of a 2D ringbuffer is reserved for the
+	 * context state:
+	 */
+	if (ring->pipe->id == FD_PIPE_2D)
+		start += STATE_SIZE;
+
+	ring->cur = ring->last_start = start;
+}
+
+int
+fd_ringbuffer_flush(struct fd_ringbuffer *ring)
+{
+	struct fd_pipe *pipe = ring->pipe;
+
+	/* the context state is executed on every submit, followed by what
+	 * was emitted since the last flush:
+	 */
+	pipe->stats.flushes++;
+	pipe->stats.dwords += ring->cur - ring->last_start;
+
+	if ((pipe->id == FD_PIPE_2D) && pipe->emulate) {
+		z1xx_emu_run(&pipe->emu, ring->start, STATE_SIZE);
+		z1xx_emu_run(&pipe->emu, ring->last_start,
+				ring->cur - ring->last_start);
+	}
+
+	ring->last_start = ring->cur;
+	ring->last_timestamp = ++pipe->timestamp;
+
+	return 0;
+}
+
+uint32_t
+fd_ringbuffer_timestamp(struct fd_ringbuffer *ring)
+{
+	return ring->last_timestamp;
+}
+
+void
+fd_ringbuffer_reloc(struct fd_ringbuffer *ring, const struct fd_reloc *reloc)
+{
+	uint32_t addr = reloc->bo->gpuaddr + reloc->offset;
+
+	ring->pipe->stats.relocs++;
+
+	if (reloc->shift < 0)
+		addr >>= -reloc->shift;
+	else
+		addr <<= reloc->shift;
+
+	fd_ringbuffer_emit(ring, addr | reloc->or);
+}
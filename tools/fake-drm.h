@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FAKE_DRM_H_
+#define FAKE_DRM_H_
+
+#include <stdint.h>
+
+/* Extra entrypoints of fake-drm.c, the stand-in for libdrm_freedreno: */
+
+struct fd_pipe;
+struct z1xx_emu;
+
+/* totals since the pipe was created: */
+struct fake_drm_stats {
+	uint64_t flushes;
+	uint64_t dwords;        /* not counting the state */
+	uint64_t relocs;
+};
+
+/* the emulator which 2D ringbuffers are run through on flush: */
+struct z1xx_emu *fake_drm_emu(struct fd_pipe *pipe);
+/* emulation is on by default, turn it off to just consume the dwords: */
+void fake_drm_emulate(struct fd_pipe *pipe, int enable);
+const struct fake_drm_stats *fake_drm_stats(struct fd_pipe *pipe);
+
+#endif /* FAKE_DRM_H_ */
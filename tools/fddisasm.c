@@ -0,0 +1,239 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Disassemble z1xx command streams, from a capture written by the driver
+ * with Option "CaptureFile" or from a raw file of dwords:
+ *
+ *    fddisasm [-r] [-a] [-s] [-m op=dwords]... file
+ *
+ *    -r   the file is raw dwords rather than a capture
+ *    -a   also decode the context state at the start of each ringbuffer
+ *    -s   only print the summary (redundant/dead writes, dwords per op)
+ *    -m   fail if any op of the given type (solid, copy or composite) is
+ *         larger than the given number of dwords, to catch regressions
+ *         in the size of what the driver emits
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "msm-capture.h"
+#include "z1xx-decode.h"
+
+static struct z1xx_decoder decoder;
+static int decode_state;
+
+static int
+read_data(FILE *f, void *buf, uint32_t size)
+{
+	if (fread(buf, size, 1, f) != 1) {
+		fprintf(stderr, "truncated capture\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+decode_ring(FILE *f, uint32_t size, uint32_t state_size, uint32_t n)
+{
+	struct capture_ring hdr;
+	struct capture_reloc reloc;
+	uint32_t *dwords, i, skip;
+
+	if ((size < sizeof(hdr)) || read_data(f, &hdr, sizeof(hdr)))
+		return -1;
+
+	if ((hdr.ndwords < state_size) ||
+			(size != sizeof(hdr) + (hdr.ndwords * sizeof(uint32_t)) +
+					(hdr.nrelocs * sizeof(reloc)))) {
+		fprintf(stderr, "bad ring: %u dwords, %u relocs\n",
+				hdr.ndwords, hdr.nrelocs);
+		return -1;
+	}
+
+	dwords = malloc(hdr.ndwords * sizeof(dwords[0]));
+	if (!dwords || read_data(f, dwords, hdr.ndwords * sizeof(dwords[0]))) {
+		free(dwords);
+		return -1;
+	}
+
+	skip = decode_state ? 0 : state_size;
+
+	if (decoder.out)
+		fprintf(decoder.out, "ring %u: %u dwords, %u relocs\n", n,
+				hdr.ndwords - skip, hdr.nrelocs);
+
+	/* offsets in the output are from the first decoded dword: */
+	z1xx_decode(&decoder, dwords + skip, hdr.ndwords - skip);
+
+	free(dwords);
+
+	for (i = 0; i < hdr.nrelocs; i++) {
+		if (read_data(f, &reloc, sizeof(reloc)))
+			return -1;
+		/* 0x2 is FD_RELOC_WRITE: */
+		if (decoder.out && (reloc.offset >= skip))
+			fprintf(decoder.out, "\treloc: %04x -> bo %u%s\n",
+					reloc.offset - skip, reloc.bo,
+					(reloc.flags & 0x2) ? " (write)" : "");
+	}
+
+	if (decoder.out)
+		fprintf(decoder.out, "\n");
+
+	return 0;
+}
+
+static int
+decode_capture(FILE *f)
+{
+	struct capture_header hdr;
+	struct capture_block block;
+	uint32_t n = 0;
+
+	if (read_data(f, &hdr, sizeof(hdr)))
+		return -1;
+
+	if ((hdr.magic != CAPTURE_MAGIC) || (hdr.version != CAPTURE_VERSION)) {
+		fprintf(stderr, "not a capture, or unsupported version\n");
+		return -1;
+	}
+
+	while (fread(&block, sizeof(block), 1, f) == 1) {
+		if (block.type == CAPTURE_RING) {
+			if (decode_ring(f, block.size, hdr.state_size, n++))
+				return -1;
+		} else if (fseek(f, block.size, SEEK_CUR)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+decode_raw(FILE *f)
+{
+	uint32_t *dwords = NULL;
+	uint32_t n = 0, max = 0;
+
+	for (;;) {
+		if (n == max) {
+			void *p;
+			max = max ? max * 2 : 0x1000;
+			p = realloc(dwords, max * sizeof(dwords[0]));
+			if (!p) {
+				free(dwords);
+				return -1;
+			}
+			dwords = p;
+		}
+		if (fread(&dwords[n], sizeof(dwords[0]), 1, f) != 1)
+			break;
+		n++;
+	}
+
+	z1xx_decode(&decoder, dwords, n);
+
+	free(dwords);
+
+	return 0;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-r] [-a] [-s] [-m op=dwords]... file\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t limits[Z1XX_OP_NR] = {0};
+	int c, i, raw = 0, summary = 0, ret = 0;
+	FILE *f;
+
+	while ((c = getopt(argc, argv, "rasm:")) != -1) {
+		switch (c) {
+		case 'r':
+			raw = 1;
+			break;
+		case 'a':
+			decode_state = 1;
+			break;
+		case 's':
+			summary = 1;
+			break;
+		case 'm': {
+			char *eq = strchr(optarg, '=');
+			if (!eq)
+				usage(argv[0]);
+			*eq = '\0';
+			for (i = 0; i < Z1XX_OP_NR; i++)
+				if (!strcmp(optarg, z1xx_op_name(i)))
+					break;
+			if (i == Z1XX_OP_NR)
+				usage(argv[0]);
+			limits[i] = strtoul(eq + 1, NULL, 0);
+			break;
+		}
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != (argc - 1))
+		usage(argv[0]);
+
+	f = fopen(argv[optind], "r");
+	if (!f) {
+		fprintf(stderr, "could not open %s: %s\n", argv[optind],
+				strerror(errno));
+		return 1;
+	}
+
+	z1xx_decode_init(&decoder, summary ? NULL : stdout);
+
+	if (raw ? decode_raw(f) : decode_capture(f)) {
+		fprintf(stderr, "decode failed\n");
+		return 1;
+	}
+
+	fclose(f);
+
+	z1xx_decode_dump_stats(&decoder, stdout);
+
+	for (i = 0; i < Z1XX_OP_NR; i++) {
+		if (limits[i] && (decoder.ops[i].max > limits[i])) {
+			fprintf(stderr, "%s: %u dwords, limit is %u\n",
+					z1xx_op_name(i), decoder.ops[i].max, limits[i]);
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
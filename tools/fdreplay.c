@@ -0,0 +1,534 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Replay a command-stream capture written by the driver with Option
+ * "CaptureFile" (see src/msm-capture.h for the format):
+ *
+ *    fdreplay [-n] [-p] [-l loops] [-o bo:file]... capture-file
+ *
+ * By default the capture is resubmitted to the 2D pipe.  With -n nothing
+ * is submitted and the capture is just parsed, to check it and to get
+ * the submit/dword/reloc counts.  With -p submits are paced to match the
+ * timing recorded in the capture, otherwise they are submitted as fast
+ * as possible.  With -o the contents of a bo are written to a file once
+ * the replay is done, for comparing the rendering.
+ *
+ * When built as fdreplay-emu (with FAKE_DRM), the capture is rendered by
+ * the software z1xx emulator rather than the gpu, so it works on any
+ * host.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include "freedreno_drmif.h"
+#include "freedreno_ringbuffer.h"
+
+#include "msm-capture.h"
+
+#ifdef FAKE_DRM
+#  include "fake-drm.h"
+#  include "z1xx-emu.h"
+#endif
+
+#define NRINGS   4
+#define NOUTPUTS 8
+
+struct replay {
+	FILE *f;
+	int null;
+	int pace;
+
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+
+	struct capture_header hdr;
+
+	/* indexed by capture bo id: */
+	struct {
+		struct fd_bo *bo;
+		int valid;
+	} *bos;
+	uint32_t nbos;
+
+	/* ringbuffers are used round-robin, and each remembers the
+	 * timestamp of its last submit so we know when it can be reused:
+	 */
+	struct {
+		struct fd_ringbuffer *ring;
+		uint32_t timestamp;
+	} rings[NRINGS];
+	int cur_ring;
+	uint32_t timestamp;
+
+	/* time of the first submit in the capture, and replay start time: */
+	uint64_t capture_start, replay_start;
+
+	/* bos to write out at the end: */
+	struct {
+		uint32_t bo;
+		const char *file;
+	} outputs[NOUTPUTS];
+	int noutputs;
+
+	/* stats: */
+	uint32_t submits, relocs;
+	uint64_t dwords, bo_bytes;
+};
+
+static uint64_t
+time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int
+read_data(struct replay *r, void *buf, uint32_t size)
+{
+	if (fread(buf, size, 1, r->f) != 1) {
+		fprintf(stderr, "truncated capture\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+open_pipe(struct replay *r)
+{
+	int fd;
+
+#ifdef FAKE_DRM
+	fd = -1;
+#else
+	fd = drmOpen("msm", NULL);
+	if (fd < 0)
+		fd = drmOpen("kgsl", NULL);
+	if (fd < 0) {
+		fprintf(stderr, "could not open drm device\n");
+		return -1;
+	}
+#endif
+
+	r->dev = fd_device_new(fd);
+	if (!r->dev) {
+		fprintf(stderr, "could not create device\n");
+		return -1;
+	}
+
+	r->pipe = fd_pipe_new(r->dev, r->hdr.pipe);
+	if (!r->pipe) {
+		fprintf(stderr, "could not open pipe %u\n", r->hdr.pipe);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+replay_bo(struct replay *r, uint32_t size)
+{
+	struct capture_bo hdr;
+	struct fd_bo *bo;
+	void *buf;
+
+	if (size < sizeof(hdr))
+		return -1;
+
+	if (read_data(r, &hdr, sizeof(hdr)))
+		return -1;
+
+	size -= sizeof(hdr);
+
+	if ((hdr.flags & CAPTURE_BO_CONTENTS) && (size != hdr.size)) {
+		fprintf(stderr, "bad bo %u size: %u\n", hdr.id, size);
+		return -1;
+	}
+
+	if (hdr.id >= r->nbos) {
+		uint32_t n = hdr.id + 64;
+		void *bos = realloc(r->bos, n * sizeof(r->bos[0]));
+		if (!bos)
+			return -1;
+		r->bos = bos;
+		memset(&r->bos[r->nbos], 0, (n - r->nbos) * sizeof(r->bos[0]));
+		r->nbos = n;
+	}
+
+	r->bos[hdr.id].valid = 1;
+	r->bo_bytes += size;
+
+	if (r->null)
+		return fseek(r->f, size, SEEK_CUR);
+
+	bo = r->bos[hdr.id].bo;
+	if (bo && (fd_bo_size(bo) < hdr.size)) {
+		fd_bo_del(bo);
+		bo = NULL;
+	}
+
+	if (!bo) {
+		bo = fd_bo_new(r->dev, hdr.size, DRM_FREEDRENO_GEM_TYPE_KMEM);
+		if (!bo) {
+			fprintf(stderr, "could not allocate bo %u\n", hdr.id);
+			return -1;
+		}
+		r->bos[hdr.id].bo = bo;
+	}
+
+	if (!size)
+		return 0;
+
+	buf = fd_bo_map(bo);
+	if (!buf) {
+		fprintf(stderr, "could not map bo %u\n", hdr.id);
+		return -1;
+	}
+
+	/* the gpu could still be using the bo from an earlier submit: */
+	fd_bo_cpu_prep(bo, r->pipe, DRM_FREEDRENO_PREP_WRITE);
+	if (read_data(r, buf, size)) {
+		fd_bo_cpu_fini(bo);
+		return -1;
+	}
+	fd_bo_cpu_fini(bo);
+
+	return 0;
+}
+
+static struct fd_ringbuffer *
+get_ring(struct replay *r, int idx, uint32_t ndwords)
+{
+	uint32_t size = ndwords * sizeof(uint32_t);
+
+	if (r->rings[idx].ring) {
+		fd_pipe_wait(r->pipe, r->rings[idx].timestamp);
+		if (r->rings[idx].ring->size < size) {
+			fd_ringbuffer_del(r->rings[idx].ring);
+			r->rings[idx].ring = NULL;
+		}
+	}
+
+	if (!r->rings[idx].ring)
+		r->rings[idx].ring = fd_ringbuffer_new(r->pipe, size);
+
+	return r->rings[idx].ring;
+}
+
+static void
+emit_reloc(struct replay *r, struct fd_ringbuffer *ring,
+		const struct capture_reloc *reloc)
+{
+	fd_ringbuffer_reloc(ring, &(struct fd_reloc){
+		.bo = r->bos[reloc->bo].bo,
+		.flags = reloc->flags,
+	});
+}
+
+static int
+submit(struct replay *r, const uint32_t *dwords, uint32_t ndwords,
+		const struct capture_reloc *relocs, uint32_t nrelocs)
+{
+	struct fd_ringbuffer *ring;
+	uint32_t i, n = 0, state_size = r->hdr.state_size;
+	int idx = r->cur_ring;
+
+	r->cur_ring = (r->cur_ring + 1) % NRINGS;
+
+	ring = get_ring(r, idx, ndwords);
+	if (!ring) {
+		fprintf(stderr, "could not allocate ringbuffer\n");
+		return -1;
+	}
+
+	fd_ringbuffer_reset(ring);
+
+	/* the state at the start of the ringbuffer is outside of what
+	 * fd_ringbuffer_reset() hands us, so it is written directly, the
+	 * same way the driver does:
+	 */
+	memcpy(ring->start, dwords, state_size * sizeof(uint32_t));
+	for (; (n < nrelocs) && (relocs[n].offset < state_size); n++) {
+		ring->cur = &ring->start[relocs[n].offset];
+		emit_reloc(r, ring, &relocs[n]);
+	}
+	ring->cur = ring->last_start;
+
+	for (i = state_size; i < ndwords; i++) {
+		if ((n < nrelocs) && (relocs[n].offset == i)) {
+			emit_reloc(r, ring, &relocs[n++]);
+		} else {
+			fd_ringbuffer_emit(ring, dwords[i]);
+		}
+	}
+
+	fd_ringbuffer_flush(ring);
+
+	r->timestamp = fd_ringbuffer_timestamp(ring);
+	r->rings[idx].timestamp = r->timestamp;
+
+	return 0;
+}
+
+static int
+compare_relocs(const void *a, const void *b)
+{
+	const struct capture_reloc *ra = a, *rb = b;
+	return (int)ra->offset - (int)rb->offset;
+}
+
+static int
+replay_ring(struct replay *r, uint32_t size)
+{
+	struct capture_ring hdr;
+	struct capture_reloc *relocs = NULL;
+	uint32_t *dwords = NULL;
+	uint32_t i;
+	int ret = -1;
+
+	if (size < sizeof(hdr))
+		return -1;
+
+	if (read_data(r, &hdr, sizeof(hdr)))
+		return -1;
+
+	if ((hdr.ndwords < r->hdr.state_size) ||
+			(size != sizeof(hdr) + (hdr.ndwords * sizeof(uint32_t)) +
+					(hdr.nrelocs * sizeof(relocs[0])))) {
+		fprintf(stderr, "bad ring: %u dwords, %u relocs\n",
+				hdr.ndwords, hdr.nrelocs);
+		return -1;
+	}
+
+	dwords = malloc(hdr.ndwords * sizeof(dwords[0]));
+	relocs = calloc(hdr.nrelocs + 1, sizeof(relocs[0]));
+	if (!dwords || !relocs)
+		goto out;
+
+	if (read_data(r, dwords, hdr.ndwords * sizeof(dwords[0])) ||
+			read_data(r, relocs, hdr.nrelocs * sizeof(relocs[0])))
+		goto out;
+
+	qsort(relocs, hdr.nrelocs, sizeof(relocs[0]), compare_relocs);
+
+	for (i = 0; i < hdr.nrelocs; i++) {
+		if ((relocs[i].offset >= hdr.ndwords) ||
+				(relocs[i].bo >= r->nbos) || !r->bos[relocs[i].bo].valid) {
+			fprintf(stderr, "bad reloc: offset %u, bo %u\n",
+					relocs[i].offset, relocs[i].bo);
+			goto out;
+		}
+	}
+
+	if (r->pace) {
+		uint64_t now = time_us();
+		if (!r->submits) {
+			r->capture_start = hdr.time_us;
+			r->replay_start = now;
+		} else {
+			uint64_t t = r->replay_start + (hdr.time_us - r->capture_start);
+			if (t > now)
+				usleep(t - now);
+		}
+	}
+
+	if (!r->null && submit(r, dwords, hdr.ndwords, relocs, hdr.nrelocs))
+		goto out;
+
+	r->submits++;
+	r->dwords += hdr.ndwords;
+	r->relocs += hdr.nrelocs;
+
+	ret = 0;
+
+out:
+	free(dwords);
+	free(relocs);
+	return ret;
+}
+
+static int
+replay(struct replay *r)
+{
+	struct capture_block block;
+
+	rewind(r->f);
+
+	if (read_data(r, &r->hdr, sizeof(r->hdr)))
+		return -1;
+
+	if ((r->hdr.magic != CAPTURE_MAGIC) ||
+			(r->hdr.version != CAPTURE_VERSION)) {
+		fprintf(stderr, "not a capture, or unsupported version\n");
+		return -1;
+	}
+
+	if (!r->null && !r->pipe && open_pipe(r))
+		return -1;
+
+	while (fread(&block, sizeof(block), 1, r->f) == 1) {
+		int ret;
+
+		switch (block.type) {
+		case CAPTURE_BO:
+			ret = replay_bo(r, block.size);
+			break;
+		case CAPTURE_RING:
+			ret = replay_ring(r, block.size);
+			break;
+		default:
+			/* skip anything we don't understand: */
+			ret = fseek(r->f, block.size, SEEK_CUR);
+			break;
+		}
+
+		if (ret)
+			return -1;
+	}
+
+	if (!r->null && r->submits)
+		fd_pipe_wait(r->pipe, r->timestamp);
+
+	return 0;
+}
+
+static int
+write_output(struct replay *r, uint32_t id, const char *file)
+{
+	struct fd_bo *bo = (id < r->nbos) ? r->bos[id].bo : NULL;
+	FILE *f;
+	int ret;
+
+	if (!bo) {
+		fprintf(stderr, "no bo %u in capture\n", id);
+		return -1;
+	}
+
+	f = fopen(file, "w");
+	if (!f) {
+		fprintf(stderr, "could not open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	fd_bo_cpu_prep(bo, r->pipe, DRM_FREEDRENO_PREP_READ);
+	ret = (fwrite(fd_bo_map(bo), fd_bo_size(bo), 1, f) == 1) ? 0 : -1;
+	fd_bo_cpu_fini(bo);
+
+	fclose(f);
+
+	return ret;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n] [-p] [-l loops] [-o bo:file]... "
+			"capture-file\n", name);
+	fprintf(stderr, "    -n        parse only, don't submit anything\n");
+	fprintf(stderr, "    -p        pace submits to the captured timing\n");
+	fprintf(stderr, "    -l loops  replay the capture this many times\n");
+	fprintf(stderr, "    -o bo:file  write the contents of bo to file\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct replay r = {0};
+	uint64_t start, elapsed;
+	int c, i, loops = 1;
+
+	while ((c = getopt(argc, argv, "npl:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			r.null = 1;
+			break;
+		case 'p':
+			r.pace = 1;
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'o': {
+			char *colon = strchr(optarg, ':');
+			if (!colon || (r.noutputs == NOUTPUTS))
+				usage(argv[0]);
+			*colon = '\0';
+			r.outputs[r.noutputs].bo = strtoul(optarg, NULL, 0);
+			r.outputs[r.noutputs].file = colon + 1;
+			r.noutputs++;
+			break;
+		}
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if ((optind != (argc - 1)) || (loops < 1) || (r.null && r.noutputs))
+		usage(argv[0]);
+
+	r.f = fopen(argv[optind], "r");
+	if (!r.f) {
+		fprintf(stderr, "could not open %s: %s\n", argv[optind],
+				strerror(errno));
+		return 1;
+	}
+
+	start = time_us();
+
+	for (i = 0; i < loops; i++) {
+		if (replay(&r)) {
+			fprintf(stderr, "replay failed after %u submits\n", r.submits);
+			return 1;
+		}
+	}
+
+	elapsed = time_us() - start;
+
+	printf("%u submits, %llu dwords, %u relocs, %llu bytes of bo data\n",
+			r.submits, (unsigned long long)r.dwords, r.relocs,
+			(unsigned long long)r.bo_bytes);
+	printf("%llu us total, %llu us/submit\n", (unsigned long long)elapsed,
+			(unsigned long long)(r.submits ? elapsed / r.submits : 0));
+
+#ifdef FAKE_DRM
+	if (r.pipe) {
+		struct z1xx_emu *e = fake_drm_emu(r.pipe);
+		printf("emulated %llu blits, %llu pixels, %u unknown, %u faults\n",
+				(unsigned long long)e->blits,
+				(unsigned long long)e->pixels, e->unknown, e->faults);
+	}
+#endif
+
+	for (i = 0; i < r.noutputs; i++)
+		if (write_output(&r, r.outputs[i].bo, r.outputs[i].file))
+			return 1;
+
+	return 0;
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "z1xx-decode.h"
+
+#define NONE  0xffffffff
+
+/* the state part of the libC2D2 captured context writes with this, the
+ * same encoding as VGV3_WRITERAW but to some other register space:
+ */
+#define WRITERAW_7B  0x7b
+
+#define NAME(reg) [reg] = #reg
+static const char *reg_names[0x100] = {
+		NAME(G2D_BASE0),
+		NAME(G2D_CFG0),
+		NAME(G2D_CFG1),
+		NAME(G2D_SCISSORX),
+		NAME(G2D_SCISSORY),
+		NAME(G2D_FOREGROUND),
+		NAME(G2D_BACKGROUND),
+		NAME(G2D_ALPHABLEND),
+		NAME(G2D_ROP),
+		NAME(G2D_CONFIG),
+		NAME(G2D_INPUT),
+		NAME(G2D_MASK),
+		NAME(G2D_BLENDERCFG),
+		NAME(G2D_CONST0),
+		NAME(G2D_CONST1),
+		NAME(G2D_CONST2),
+		NAME(G2D_CONST3),
+		NAME(G2D_CONST4),
+		NAME(G2D_CONST5),
+		NAME(G2D_CONST6),
+		NAME(G2D_CONST7),
+		NAME(G2D_GRADIENT),
+		NAME(G2D_XY),
+		NAME(G2D_WIDTHHEIGHT),
+		NAME(G2D_SXY),
+		NAME(G2D_SXY2),
+		NAME(G2D_IDLE),
+		NAME(G2D_COLOR),
+		NAME(G2D_BLEND_A0),
+		NAME(G2D_BLEND_A1),
+		NAME(G2D_BLEND_A2),
+		NAME(G2D_BLEND_A3),
+		NAME(G2D_BLEND_C0),
+		NAME(G2D_BLEND_C1),
+		NAME(G2D_BLEND_C2),
+		NAME(G2D_BLEND_C3),
+		NAME(G2D_BLEND_C4),
+		NAME(G2D_BLEND_C5),
+		NAME(G2D_BLEND_C6),
+		NAME(G2D_BLEND_C7),
+		NAME(VGV1_DIRTYBASE),
+		NAME(VGV1_CBASE1),
+		NAME(VGV1_UBASE2),
+		NAME(VGV3_NEXTADDR),
+		NAME(VGV3_NEXTCMD),
+		NAME(VGV3_WRITERAW),
+		NAME(VGV3_LAST),
+		NAME(GRADW_CONST0),
+		NAME(GRADW_CONST1),
+		NAME(GRADW_CONST2),
+		NAME(GRADW_CONST3),
+		NAME(GRADW_CONST4),
+		NAME(GRADW_CONST5),
+		NAME(GRADW_CONST6),
+		NAME(GRADW_CONST7),
+		NAME(GRADW_CONST8),
+		NAME(GRADW_CONST9),
+		NAME(GRADW_CONSTA),
+		NAME(GRADW_CONSTB),
+		NAME(GRADW_TEXCFG),
+		NAME(GRADW_TEXSIZE),
+		NAME(GRADW_TEXBASE),
+		NAME(GRADW_TEXCFG2),
+		NAME(GRADW_INST0),
+		NAME(GRADW_INST1),
+		NAME(GRADW_INST2),
+		NAME(GRADW_INST3),
+		NAME(GRADW_INST4),
+		NAME(GRADW_INST5),
+		NAME(GRADW_INST6),
+		NAME(GRADW_INST7),
+};
+#undef NAME
+
+static const char *op_names[Z1XX_OP_NR] = {
+		[Z1XX_OP_SOLID]     = "solid",
+		[Z1XX_OP_COPY]      = "copy",
+		[Z1XX_OP_COMPOSITE] = "composite",
+};
+
+enum reg_class {
+	REG_STATE,      /* plain state */
+	REG_SEQ,        /* state, but written in sequences on purpose */
+	REG_GRADW,      /* banked by G2D_GRADIENT, not tracked */
+	REG_KICK,       /* starts a blit */
+	REG_TAIL,       /* part of the blit started by the last kick */
+	REG_CONTROL,    /* packet/submit level, not part of any blit */
+};
+
+static enum reg_class
+reg_class(uint32_t reg)
+{
+	switch (reg) {
+	case G2D_INPUT:
+		/* the input fields seem to need to be enabled/disabled in a
+		 * certain order, so back to back writes are expected:
+		 */
+		return REG_SEQ;
+	case G2D_XY:
+		return REG_KICK;
+	case G2D_WIDTHHEIGHT:
+	case G2D_SXY:
+	case G2D_SXY2:
+	case G2D_COLOR:
+	case G2D_GRADIENT:
+		return REG_TAIL;
+	case G2D_IDLE:
+	case VGV1_DIRTYBASE:
+	case VGV1_CBASE1:
+	case VGV1_UBASE2:
+	case VGV3_NEXTADDR:
+	case VGV3_NEXTCMD:
+	case VGV3_WRITERAW:
+	case VGV3_LAST:
+		return REG_CONTROL;
+	default:
+		if ((reg >= GRADW_CONST0) && (reg <= GRADW_INST7))
+			return REG_GRADW;
+		return REG_STATE;
+	}
+}
+
+const char *
+z1xx_reg_name(uint32_t reg)
+{
+	return (reg < 0x100) ? reg_names[reg] : NULL;
+}
+
+const char *
+z1xx_op_name(enum z1xx_op op)
+{
+	return op_names[op];
+}
+
+void
+z1xx_decode_init(struct z1xx_decoder *d, FILE *out)
+{
+	memset(d, 0, sizeof(*d));
+	d->out = out;
+	d->op_start = NONE;
+}
+
+static void
+reset_state(struct z1xx_decoder *d)
+{
+	memset(d->valid, 0, sizeof(d->valid));
+	memset(d->pending, 0xff, sizeof(d->pending));
+	d->op_start = NONE;
+	d->in_tail = 0;
+	d->raw_texsize = 0;
+}
+
+static void
+close_op(struct z1xx_decoder *d, uint32_t end)
+{
+	struct z1xx_op_stats *stats;
+	uint32_t config = d->valid[G2D_CONFIG] ? d->val[G2D_CONFIG] : 0;
+	uint32_t n = end - d->op_start;
+	enum z1xx_op op;
+
+	if (config & G2D_CONFIG_DST)
+		op = Z1XX_OP_COMPOSITE;
+	else if (config & G2D_CONFIG_SRC1)
+		op = Z1XX_OP_COPY;
+	else
+		op = Z1XX_OP_SOLID;
+
+	stats = &d->ops[op];
+	if (!stats->count || (n < stats->min))
+		stats->min = n;
+	if (n > stats->max)
+		stats->max = n;
+	stats->count++;
+	stats->dwords += n;
+
+	if (d->out)
+		fprintf(d->out, "\t\t-- %s: %u dwords\n", op_names[op], n);
+
+	d->in_tail = 0;
+	d->op_start = NONE;
+}
+
+/* hdr is the offset of the dword the write is encoded in (or the REGM
+ * header), offset and raw the offset and dword of the value itself:
+ */
+static void
+write_reg(struct z1xx_decoder *d, uint32_t hdr, uint32_t offset,
+		uint32_t raw, uint32_t reg, uint32_t val)
+{
+	enum reg_class class = reg_class(reg);
+	const char *name = reg_names[reg];
+	const char *note = "";
+	uint32_t dead = NONE;
+
+	d->writes++;
+	if (!name)
+		d->unknown++;
+
+	if (d->in_tail && ((class != REG_TAIL) ||
+			((reg == G2D_GRADIENT) && (val & 0xffffff)))) {
+		close_op(d, hdr);
+	}
+
+	if ((class != REG_CONTROL) && (d->op_start == NONE))
+		d->op_start = hdr;
+
+	switch (class) {
+	case REG_STATE:
+	case REG_SEQ:
+		if (d->valid[reg] && (d->val[reg] == val)) {
+			d->redundant++;
+			note = "  (redundant)";
+			break;
+		}
+		if (class == REG_STATE) {
+			if (d->pending[reg] != NONE) {
+				d->dead++;
+				dead = d->pending[reg];
+			}
+			d->pending[reg] = offset;
+		}
+		break;
+	case REG_KICK:
+		/* whatever state was pending is now consumed: */
+		memset(d->pending, 0xff, sizeof(d->pending));
+		d->in_tail = 1;
+		break;
+	case REG_TAIL:
+		if ((reg == G2D_GRADIENT) && ((val & 0xffffff) == 0x030000))
+			d->raw_texsize = 1;
+		break;
+	case REG_GRADW:
+		break;
+	case REG_CONTROL:
+		d->op_start = NONE;
+		break;
+	}
+
+	d->val[reg] = val;
+	d->valid[reg] = 1;
+
+	if (d->out) {
+		char buf[8];
+		if (!name) {
+			snprintf(buf, sizeof(buf), "REG_%02x", reg);
+			name = buf;
+		}
+		fprintf(d->out, "%04x: %08x\t%-16s %08x%s\n", offset,
+				raw, name, val, note);
+		if (dead != NONE)
+			fprintf(d->out, "\t\t-- overwrites dead write at %04x\n", dead);
+	}
+}
+
+void
+z1xx_decode(struct z1xx_decoder *d, const uint32_t *dwords, uint32_t ndwords)
+{
+	uint32_t i, j;
+
+	reset_state(d);
+
+	for (i = 0; i < ndwords; i++) {
+		uint32_t dword = dwords[i];
+		uint32_t op = dword >> 24;
+
+		d->dwords++;
+
+		if (d->raw_texsize) {
+			/* decodes as a G2D_BASE0 (or G2D_CFG0) write as well, but
+			 * what that actually does to them is not known:
+			 */
+			d->raw_texsize = 0;
+			d->valid[G2D_BASE0] = d->valid[G2D_CFG0] = 0;
+			d->pending[G2D_BASE0] = d->pending[G2D_CFG0] = NONE;
+			if (d->out)
+				fprintf(d->out, "%04x: %08x\t%-16s %08x  (raw)\n", i, dword,
+						"GRADW_TEXSIZE", dword);
+			continue;
+		}
+
+		if ((op == VGV3_WRITERAW) || (op == WRITERAW_7B)) {
+			uint32_t reg = dword & 0xff;
+			uint32_t count = (dword >> 8) & 0xff;
+
+			if (d->out)
+				fprintf(d->out, "%04x: %08x\t%s(%u)\n", i, dword,
+						(op == VGV3_WRITERAW) ? "WRITERAW" : "WRITERAW_7B",
+						count);
+
+			for (j = 0; (j < count) && ((i + 1) < ndwords); j++) {
+				i++;
+				d->dwords++;
+				if (op == WRITERAW_7B) {
+					/* different register space, just show it: */
+					if (d->out) {
+						char buf[8];
+						snprintf(buf, sizeof(buf), "[7b]%02x", (reg + j) & 0xff);
+						fprintf(d->out, "%04x: %08x\t%-16s %08x\n",
+								i, dwords[i], buf, dwords[i]);
+					}
+					continue;
+				}
+				write_reg(d, i - j - 1, i, dwords[i], (reg + j) & 0xff,
+						dwords[i]);
+			}
+		} else {
+			write_reg(d, i, i, dword, op, dword & 0xffffff);
+		}
+	}
+
+	if (d->in_tail)
+		close_op(d, ndwords);
+}
+
+void
+z1xx_decode_dump_stats(struct z1xx_decoder *d, FILE *out)
+{
+	int i;
+
+	fprintf(out, "%u dwords, %u register writes, %u redundant, %u dead, "
+			"%u to unknown registers\n", d->dwords, d->writes,
+			d->redundant, d->dead, d->unknown);
+	fprintf(out, "%-10s %8s %10s %6s %6s %6s\n", "op", "count", "dwords",
+			"avg", "min", "max");
+	for (i = 0; i < Z1XX_OP_NR; i++) {
+		struct z1xx_op_stats *stats = &d->ops[i];
+		if (!stats->count)
+			continue;
+		fprintf(out, "%-10s %8u %10llu %6llu %6u %6u\n", op_names[i],
+				stats->count, (unsigned long long)stats->dwords,
+				(unsigned long long)(stats->dwords / stats->count),
+				stats->min, stats->max);
+	}
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef Z1XX_DECODE_H_
+#define Z1XX_DECODE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "freedreno_z1xx.h"
+
+/* Decoder for z1xx command streams, turning the dwords into register
+ * writes and keeping track of:
+ *
+ *  + redundant writes, ie. writing the value the register already holds
+ *  + dead writes, ie. state overwritten before any blit used it
+ *  + the number of dwords emitted per blit, by type of blit
+ *
+ * A blit is kicked off by the G2D_XY write, and is considered to extend
+ * up to the last of the G2D_XY/G2D_SXY/G2D_COLOR/G2D_GRADIENT writes that
+ * follow it, which is how the driver emits them.
+ */
+
+enum z1xx_op {
+	Z1XX_OP_SOLID,
+	Z1XX_OP_COPY,
+	Z1XX_OP_COMPOSITE,
+	Z1XX_OP_NR,
+};
+
+struct z1xx_op_stats {
+	uint32_t count;
+	uint64_t dwords;
+	uint32_t min, max;
+};
+
+struct z1xx_decoder {
+	FILE *out;              /* NULL to just gather stats */
+
+	/* register state, tracked since the start of the stream: */
+	uint32_t val[0x100];
+	uint8_t valid[0x100];
+	/* offset of a state write not consumed by a blit yet, or ~0: */
+	uint32_t pending[0x100];
+
+	/* current blit: */
+	uint32_t op_start;
+	int in_tail;
+
+	/* G2D_GRADIENT 0x030000 is followed by a raw GRADW_TEXSIZE: */
+	int raw_texsize;
+
+	/* totals: */
+	uint32_t dwords, writes, redundant, dead, unknown;
+	struct z1xx_op_stats ops[Z1XX_OP_NR];
+};
+
+const char *z1xx_reg_name(uint32_t reg);
+const char *z1xx_op_name(enum z1xx_op op);
+
+void z1xx_decode_init(struct z1xx_decoder *d, FILE *out);
+/* decode a stream (ie. one ringbuffer), register state is reset first: */
+void z1xx_decode(struct z1xx_decoder *d, const uint32_t *dwords,
+		uint32_t ndwords);
+void z1xx_decode_dump_stats(struct z1xx_decoder *d, FILE *out);
+
+#endif /* Z1XX_DECODE_H_ */
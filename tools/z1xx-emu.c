@@ -0,0 +1,492 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <X11/extensions/render.h>
+
+#include "z1xx-emu.h"
+#include "msm-blend.h"
+
+#define WRITERAW_7B  0x7b
+
+/* G2D_GRADIENT value the driver uses to turn on repeat of the src: */
+#define GRADIENT_REPEAT  0x1001
+
+/* G2D_BLENDERCFG bit set by the driver when the dst has no alpha: */
+#define BLENDERCFG_NODSTALPHA  0x00200000
+
+struct surface {
+	uint8_t *ptr;
+	uint32_t pitch, width, height;
+	enum g2d_format fmt;
+	int repeat_u, repeat_v;
+};
+
+void
+z1xx_emu_init(struct z1xx_emu *e,
+		void *(*map)(void *arg, uint32_t gpuaddr, uint32_t size), void *arg)
+{
+	memset(e, 0, sizeof(*e));
+	e->map = map;
+	e->arg = arg;
+}
+
+static int
+cpp(enum g2d_format fmt)
+{
+	switch (fmt) {
+	case G2D_8:
+	case G2D_A8:
+		return 1;
+	case G2D_4444:
+	case G2D_1555:
+	case G2D_0565:
+		return 2;
+	case G2D_8888:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+/* all pixels are converted to/from a8r8g8b8: */
+static uint32_t
+load(const struct surface *s, int x, int y)
+{
+	const uint8_t *p = s->ptr + (y * s->pitch);
+	uint32_t v;
+
+	switch (s->fmt) {
+	case G2D_8:
+	case G2D_A8:
+		return p[x] << 24;
+	case G2D_0565:
+		v = ((const uint16_t *)p)[x];
+		return 0xff000000 |
+				((v & 0xf800) << 8) | ((v & 0xe000) << 3) |
+				((v & 0x07e0) << 5) | ((v & 0x0600) >> 1) |
+				((v & 0x001f) << 3) | ((v & 0x001c) >> 2);
+	case G2D_4444:
+		v = ((const uint16_t *)p)[x];
+		return ((v & 0xf000) * 0x11000) | ((v & 0x0f00) * 0x1100) |
+				((v & 0x00f0) * 0x110) | ((v & 0x000f) * 0x11);
+	case G2D_1555:
+		v = ((const uint16_t *)p)[x];
+		return ((v & 0x8000) ? 0xff000000 : 0) |
+				((v & 0x7c00) << 9) | ((v & 0x7000) << 4) |
+				((v & 0x03e0) << 6) | ((v & 0x0380) << 1) |
+				((v & 0x001f) << 3) | ((v & 0x001c) >> 2);
+	default:
+		return ((const uint32_t *)p)[x];
+	}
+}
+
+static void
+store(const struct surface *s, int x, int y, uint32_t v)
+{
+	uint8_t *p = s->ptr + (y * s->pitch);
+
+	switch (s->fmt) {
+	case G2D_8:
+	case G2D_A8:
+		p[x] = v >> 24;
+		break;
+	case G2D_0565:
+		((uint16_t *)p)[x] = ((v >> 8) & 0xf800) |
+				((v >> 5) & 0x07e0) | ((v >> 3) & 0x001f);
+		break;
+	case G2D_4444:
+		((uint16_t *)p)[x] = ((v >> 16) & 0xf000) |
+				((v >> 12) & 0x0f00) | ((v >> 8) & 0x00f0) |
+				((v >> 4) & 0x000f);
+		break;
+	case G2D_1555:
+		((uint16_t *)p)[x] = ((v >> 16) & 0x8000) |
+				((v >> 9) & 0x7c00) | ((v >> 6) & 0x03e0) |
+				((v >> 3) & 0x001f);
+		break;
+	default:
+		((uint32_t *)p)[x] = v;
+		break;
+	}
+}
+
+static int
+wrap(int c, int size, int repeat)
+{
+	if (!repeat)
+		return c;
+	c %= size;
+	return (c < 0) ? c + size : c;
+}
+
+/* out of bounds texels, when not repeating, are transparent: */
+static uint32_t
+fetch(const struct surface *s, int x, int y)
+{
+	x = wrap(x, s->width, s->repeat_u);
+	y = wrap(y, s->height, s->repeat_v);
+	if ((x < 0) || (y < 0) || (x >= s->width) || (y >= s->height))
+		return 0;
+	return load(s, x, y);
+}
+
+static int
+map_surface(struct z1xx_emu *e, struct surface *s, uint32_t base,
+		uint32_t cfg, uint32_t width, uint32_t height)
+{
+	s->pitch = (cfg & 0xfff) * 32;
+	s->fmt = (cfg >> 12) & 0xf;
+	s->width = width;
+	s->height = height;
+
+	if (!cpp(s->fmt) || !width || !height) {
+		e->unknown++;
+		return -1;
+	}
+
+	s->ptr = e->map(e->arg, base, s->pitch * (height - 1) +
+			(width * cpp(s->fmt)));
+	if (!s->ptr) {
+		e->faults++;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+map_tex(struct z1xx_emu *e, struct surface *s, enum z1xx_emu_tex tex)
+{
+	uint32_t *gradw = e->gradw[tex];
+	uint32_t texcfg = gradw[GRADW_TEXCFG];
+	uint32_t texsize = gradw[GRADW_TEXSIZE];
+
+	if (map_surface(e, s, gradw[GRADW_TEXBASE], texcfg,
+			texsize & 0x7ff, (texsize >> 13) & 0x7ff))
+		return -1;
+
+	s->repeat_u = ((texcfg >> 17) & 0x3) == G2D_REPEAT;
+	s->repeat_v = ((texcfg >> 19) & 0x3) == G2D_REPEAT;
+
+	if ((tex == Z1XX_TEX_SRC) &&
+			((e->kick_gradient & GRADIENT_REPEAT) == GRADIENT_REPEAT))
+		s->repeat_u = s->repeat_v = 1;
+
+	return 0;
+}
+
+/*
+ * Blending, with the same rounding as pixman so the results can be
+ * compared exactly:
+ */
+
+static inline uint32_t
+mul_un8(uint32_t a, uint32_t b)
+{
+	uint32_t t = (a * b) + 0x80;
+	return ((t >> 8) + t) >> 8;
+}
+
+static inline uint32_t
+mul_un8x4(uint32_t v, uint32_t a)
+{
+	return (mul_un8(v >> 24, a) << 24) |
+			(mul_un8((v >> 16) & 0xff, a) << 16) |
+			(mul_un8((v >> 8) & 0xff, a) << 8) |
+			mul_un8(v & 0xff, a);
+}
+
+static inline uint32_t
+add_un8x4(uint32_t a, uint32_t b)
+{
+	uint32_t r = 0;
+	int i;
+	for (i = 0; i < 32; i += 8) {
+		uint32_t c = ((a >> i) & 0xff) + ((b >> i) & 0xff);
+		r |= ((c > 0xff) ? 0xff : c) << i;
+	}
+	return r;
+}
+
+static uint32_t
+blend(int op, uint32_t s, uint32_t d)
+{
+	uint32_t as = s >> 24, ad = d >> 24;
+	uint32_t fs, fd;
+
+	switch (op) {
+	case PictOpSrc:         fs = 0xff;      fd = 0;         break;
+	case PictOpIn:          fs = ad;        fd = 0;         break;
+	case PictOpOut:         fs = 0xff - ad; fd = 0;         break;
+	case PictOpOver:        fs = 0xff;      fd = 0xff - as; break;
+	case PictOpOutReverse:  fs = 0;         fd = 0xff - as; break;
+	case PictOpAdd:         fs = 0xff;      fd = 0xff;      break;
+	case PictOpOverReverse: fs = 0xff - ad; fd = 0xff;      break;
+	case PictOpInReverse:   fs = 0;         fd = as;        break;
+	case PictOpAtop:        fs = ad;        fd = 0xff - as; break;
+	case PictOpAtopReverse: fs = 0xff - ad; fd = as;        break;
+	case PictOpXor:         fs = 0xff - ad; fd = 0xff - as; break;
+	default:                fs = 0xff;      fd = 0;         break;
+	}
+
+	return add_un8x4(mul_un8x4(s, fs), mul_un8x4(d, fd));
+}
+
+/* find the render op the driver set up the blender for, from the
+ * G2D_BLEND_A0/C0 values, the same way the driver picks them:
+ */
+static int
+find_op(struct z1xx_emu *e, int dst_alpha, int *src_alpha)
+{
+	uint32_t a0 = e->regs[G2D_BLEND_A0], c0 = e->regs[G2D_BLEND_C0];
+	int i, op;
+
+	/* try src with alpha first, for ops where it doesn't matter: */
+	for (i = 1; i >= 0; i--) {
+		const uint32_t (*ops)[4] = composite_op_dwords[(i * 2) + dst_alpha];
+		for (op = 0; op <= PictOpAdd; op++) {
+			const uint32_t *dw = ops[op];
+			if (!dw[1])
+				continue;
+			if ((dw[0] ? dw[1] : (dw[1] & 0xffffff)) != a0)
+				continue;
+			if ((dw[2] ? dw[3] : (dw[3] & 0xffffff)) != c0)
+				continue;
+			*src_alpha = i;
+			return op;
+		}
+	}
+
+	return -1;
+}
+
+/* the raster op, when the blender is bypassed (see G2D_ROP_ROP3()): */
+static uint32_t
+rop3(uint32_t rop, uint32_t s, uint32_t d)
+{
+	uint32_t v = 0;
+
+	if (rop & 0x1)
+		v |= ~s & ~d;
+	if (rop & 0x2)
+		v |= ~s & d;
+	if (rop & 0x4)
+		v |= s & ~d;
+	if (rop & 0x8)
+		v |= s & d;
+
+	return v;
+}
+
+static void
+blit(struct z1xx_emu *e)
+{
+	struct surface dst, src, mask;
+	uint32_t config = e->regs[G2D_CONFIG];
+	uint32_t blendercfg = e->regs[G2D_BLENDERCFG];
+	uint32_t xy = e->regs[G2D_XY], wh = e->regs[G2D_WIDTHHEIGHT];
+	uint32_t sxy = e->regs[G2D_SXY], sxy2 = e->regs[G2D_SXY2];
+	uint32_t scx = e->regs[G2D_SCISSORX], scy = e->regs[G2D_SCISSORY];
+	uint32_t dsize = e->gradw[Z1XX_TEX_DST][GRADW_TEXSIZE];
+	int x0 = (xy >> 16) & 0xfff, y0 = xy & 0xfff;
+	int w = (wh >> 16) & 0xfff, h = wh & 0xfff;
+	int sx = (sxy >> 16) & 0x7ff, sy = sxy & 0x7ff;
+	int mx = (sxy2 >> 16) & 0x7ff, my = sxy2 & 0x7ff;
+	int x1 = x0 + w, y1 = y0 + h;
+	int use_src = !!(config & G2D_CONFIG_SRC1);
+	int use_mask = (config & G2D_CONFIG_SRC2) &&
+			!(blendercfg & G2D_BLENDERCFG_NOMASK);
+	int blending = !!(blendercfg & G2D_BLENDERCFG_ENABLE);
+	int dst_alpha = !(blendercfg & BLENDERCFG_NODSTALPHA);
+	int src_alpha = 1, op = PictOpSrc;
+	uint32_t rop = e->regs[G2D_ROP] & 0xffff;
+	uint32_t argbmask = (config >> 12) & 0xf, keep = 0;
+	int read_dst = !!(config & G2D_CONFIG_DST);
+	int x, y;
+
+	e->pending = 0;
+	e->blits++;
+
+	/* the canned state's 0x0000 and the context's 0x0404 are taken to
+	 * be a plain copy or fill, which is all they are used for:
+	 */
+	rop = ((rop == 0x0000) || (rop == 0x0404)) ? 0xcc : (rop & 0xff);
+
+	/* clip to the scissor: */
+	x0 = (x0 > (scx & 0xfff)) ? x0 : (scx & 0xfff);
+	y0 = (y0 > (scy & 0xfff)) ? y0 : (scy & 0xfff);
+	x1 = (x1 < ((scx >> 12) & 0xfff)) ? x1 : ((scx >> 12) & 0xfff);
+	y1 = (y1 < ((scy >> 12) & 0xfff)) ? y1 : ((scy >> 12) & 0xfff);
+
+	if ((x0 >= x1) || (y0 >= y1))
+		return;
+
+	if (map_surface(e, &dst, e->regs[G2D_BASE0], e->regs[G2D_CFG0],
+			dsize & 0x7ff, (dsize >> 13) & 0x7ff))
+		return;
+
+	if ((x1 > dst.width) || (y1 > dst.height)) {
+		e->faults++;
+		return;
+	}
+
+	if (use_src && map_tex(e, &src, Z1XX_TEX_SRC))
+		return;
+
+	if (use_mask && map_tex(e, &mask, Z1XX_TEX_MASK))
+		return;
+
+	if (blending) {
+		op = find_op(e, dst_alpha, &src_alpha);
+		if (op < 0) {
+			e->unknown++;
+			return;
+		}
+	} else if ((rop >> 4) != (rop & 0xf)) {
+		/* depends on the pattern, which the driver never uses: */
+		e->unknown++;
+		return;
+	} else if (!read_dst && (((rop >> 1) & 0x5) != (rop & 0x5))) {
+		e->unknown++;
+		return;
+	}
+
+	/* channels not written, see G2D_CONFIG_ARGBMASK(): */
+	if (argbmask && !read_dst) {
+		e->unknown++;
+		return;
+	}
+	for (x = 0; x < 4; x++)
+		if (argbmask & (0x8 >> x))
+			keep |= 0xff000000 >> (8 * x);
+
+	sx -= x0 - ((xy >> 16) & 0xfff);
+	sy -= y0 - (xy & 0xfff);
+	mx -= x0 - ((xy >> 16) & 0xfff);
+	my -= y0 - (xy & 0xfff);
+
+	for (y = y0; y < y1; y++) {
+		for (x = x0; x < x1; x++) {
+			uint32_t s, d;
+
+			if (!use_src) {
+				s = e->regs[G2D_COLOR];
+			} else {
+				s = fetch(&src, sx + (x - x0), sy + (y - y0));
+				if (blending && !src_alpha)
+					s |= 0xff000000;
+			}
+
+			if (use_mask)
+				s = mul_un8x4(s, fetch(&mask, mx + (x - x0),
+						my + (y - y0)) >> 24);
+
+			if (blending) {
+				d = load(&dst, x, y);
+				if (!dst_alpha)
+					d |= 0xff000000;
+				s = blend(op, s, d);
+			} else if (rop != 0xcc) {
+				d = read_dst ? load(&dst, x, y) : 0;
+				s = rop3(rop, s, d);
+			}
+
+			if (keep)
+				s = (s & ~keep) | (load(&dst, x, y) & keep);
+
+			store(&dst, x, y, s);
+		}
+	}
+
+	e->pixels += (x1 - x0) * (y1 - y0);
+}
+
+static void
+write_reg(struct z1xx_emu *e, uint32_t reg, uint32_t val)
+{
+	/* the deferred blit happens once anything but the rest of its
+	 * parameters is written:
+	 */
+	if (e->pending && (reg != G2D_WIDTHHEIGHT) && (reg != G2D_SXY) &&
+			(reg != G2D_SXY2) && (reg != G2D_COLOR))
+		blit(e);
+
+	switch (reg) {
+	case G2D_GRADIENT:
+		e->gradient = val;
+		if ((val & 0xffffff) == 0x030000)
+			e->raw_texsize = 1;
+		break;
+	case G2D_XY:
+		e->regs[reg] = val;
+		e->kick_gradient = e->gradient;
+		e->pending = 1;
+		break;
+	default:
+		if ((reg >= GRADW_CONST0) && (reg <= GRADW_INST7))
+			e->gradw[(e->gradient >> 16) & 0x3][reg] = val;
+		else
+			e->regs[reg] = val;
+		break;
+	}
+}
+
+void
+z1xx_emu_run(struct z1xx_emu *e, const uint32_t *dwords, uint32_t ndwords)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < ndwords; i++) {
+		uint32_t dword = dwords[i];
+		uint32_t op = dword >> 24;
+
+		e->dwords++;
+
+		if (e->raw_texsize) {
+			e->raw_texsize = 0;
+			e->gradw[Z1XX_TEX_DST][GRADW_TEXSIZE] = dword;
+			continue;
+		}
+
+		if ((op == VGV3_WRITERAW) || (op == WRITERAW_7B)) {
+			uint32_t reg = dword & 0xff;
+			uint32_t count = (dword >> 8) & 0xff;
+
+			for (j = 0; (j < count) && ((i + 1) < ndwords); j++) {
+				i++;
+				e->dwords++;
+				/* different register space, not emulated: */
+				if (op == WRITERAW_7B)
+					continue;
+				write_reg(e, (reg + j) & 0xff, dwords[i]);
+			}
+		} else {
+			write_reg(e, op, dword & 0xffffff);
+		}
+	}
+
+	if (e->pending)
+		blit(e);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2014 freedreno contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef Z1XX_EMU_H_
+#define Z1XX_EMU_H_
+
+#include <stdint.h>
+
+#include "freedreno_z1xx.h"
+
+/* Software interpreter for the subset of the z1xx command stream which
+ * the driver emits: solid fills and copies with a raster op of the src
+ * and dst and a per-channel write mask, and composite with the blender
+ * setups from msm-blend.h, with repeat on the src and an A8 (or alpha
+ * of ARGB) mask.  It renders into host memory, with gpu addresses
+ * translated by the map callback.
+ *
+ * This is built from what the driver emits and what libC2D2 was seen to
+ * do, rather than any documentation, so it only knows the semantics the
+ * driver relies on.  Anything it doesn't understand is counted in
+ * 'unknown' rather than guessed at.
+ */
+
+/* texture units, as selected by G2D_GRADIENT: */
+enum z1xx_emu_tex {
+	Z1XX_TEX_SRC  = 0,
+	Z1XX_TEX_MASK = 2,
+	Z1XX_TEX_DST  = 3,
+	Z1XX_TEX_NR   = 4,
+};
+
+struct z1xx_emu {
+	/* translate a gpu address to a host pointer, NULL if the range is
+	 * not valid:
+	 */
+	void *(*map)(void *arg, uint32_t gpuaddr, uint32_t size);
+	void *arg;
+
+	uint32_t regs[0x100];
+	uint32_t gradw[Z1XX_TEX_NR][0x100];
+	uint32_t gradient;
+
+	/* a blit has been kicked by G2D_XY, but is deferred until the rest
+	 * of its coordinates and color have been written:
+	 */
+	int pending;
+	uint32_t kick_gradient;
+
+	/* G2D_GRADIENT 0x030000 is followed by a raw GRADW_TEXSIZE: */
+	int raw_texsize;
+
+	/* stats: */
+	uint64_t dwords, blits, pixels;
+	uint32_t unknown, faults;
+};
+
+void z1xx_emu_init(struct z1xx_emu *e,
+		void *(*map)(void *arg, uint32_t gpuaddr, uint32_t size), void *arg);
+void z1xx_emu_run(struct z1xx_emu *e, const uint32_t *dwords, uint32_t ndwords);
+
+#endif /* Z1XX_EMU_H_ */